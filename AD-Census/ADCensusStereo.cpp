@@ -4,14 +4,33 @@
 * Describe	: implement of ad-census stereo class
 */
 #include "ADCensusStereo.h"
+#include "adcensus_util.h"
 #include <algorithm>
 #include <chrono>
 #include <cstdio>
 #include <cstring>
 using namespace std::chrono;
 
+namespace
+{
+	/** \brief costs of one row as float32, a float32 volume is used directly */
+	template<typename T>
+	const float32* LoadRowCosts(const T* src, const sint32& n, float32* buffer)
+	{
+		for (sint32 k = 0; k < n; k++) {
+			buffer[k] = CostTraits<T>::Load(src[k]);
+		}
+		return buffer;
+	}
+	inline const float32* LoadRowCosts(const float32* src, const sint32&, float32*)
+	{
+		return src;
+	}
+}
+
 ADCensusStereo::ADCensusStereo(): width_(0), height_(0), img_left_(nullptr), img_right_(nullptr),
                                   disp_left_(nullptr), disp_right_(nullptr),
+                                  wta_row_costs_(nullptr), wta_right_min_(nullptr), wta_right_best_(nullptr),
                                   is_initialized_(false) { }
 
 ADCensusStereo::~ADCensusStereo()
@@ -40,19 +59,50 @@ bool ADCensusStereo::Initialize(const sint32& width, const sint32& height, const
 	if (disp_range <= 0) {
 		return false;
 	}
+	if (option_.so_num_paths != 4 && option_.so_num_paths != 8 && option_.so_num_paths != 16) {
+		return false;
+	}
+
+	// the cost volumes, the disparity maps and the buffers of the aggregation and the refinement are taken from the arena,
+	// the steps get it before they are initialized
+	arena_.Release();
+	arena_.SetHugePages(option_.huge_pages);
+	cost_computer_.SetArena(&arena_);
+	aggregator_.SetArena(&arena_);
+	refiner_.SetArena(&arena_);
 
 	// �Ӳ�ͼ
-	disp_left_ = new float32[img_size];
-	disp_right_ = new float32[img_size];
+	disp_left_ = arena_.Allocate<float32>(img_size);
+	disp_right_ = arena_.Allocate<float32>(img_size);
+
+	// thread pool, set on the steps before they are initialized so they allocate their per thread buffers
+	thread_pool_.Initialize(option_.num_threads);
+	cost_computer_.SetThreadPool(&thread_pool_);
+	aggregator_.SetThreadPool(&thread_pool_);
+	scan_line_.SetThreadPool(&thread_pool_);
+	refiner_.SetThreadPool(&thread_pool_);
+
+	// the per thread buffers of ComputeDisparity, the fused last scanline pass computes the disparities without them
+	wta_row_costs_ = nullptr;
+	wta_right_min_ = nullptr;
+	wta_right_best_ = nullptr;
+	if (!FusedWta()) {
+		const sint32 num_threads = thread_pool_.num_threads();
+		if (option_.cost_type != CostFloat32) {
+			wta_row_costs_ = arena_.Allocate<float32>(static_cast<size_t>(num_threads) * width_ * disp_range);
+		}
+		wta_right_min_ = arena_.Allocate<float32>(num_threads * width_);
+		wta_right_best_ = arena_.Allocate<sint32>(num_threads * width_);
+	}
 
 	// ��ʼ�����ۼ�����
-	if(!cost_computer_.Initialize(width_,height_,option_.min_disparity,option_.max_disparity)) {
+	if(!cost_computer_.Initialize(width_,height_,option_.min_disparity,option_.max_disparity,option_.cost_type,option_.cost_layout)) {
 		is_initialized_ = false;
 		return is_initialized_;
 	}
 
 	// ��ʼ�����۾ۺ���
-	if(!aggregator_.Initialize(width_, height_,option_.min_disparity,option_.max_disparity)) {
+	if(!aggregator_.Initialize(width_, height_,option_.min_disparity,option_.max_disparity,option_.cost_type)) {
 		is_initialized_ = false;
 		return is_initialized_;
 	}
@@ -69,6 +119,11 @@ bool ADCensusStereo::Initialize(const sint32& width, const sint32& height, const
 }
 
 bool ADCensusStereo::Match(const uint8* img_left, const uint8* img_right, float32* disp_left)
+{
+	return Match(img_left, img_right, disp_left, nullptr);
+}
+
+bool ADCensusStereo::Match(const uint8* img_left, const uint8* img_right, float32* disp_left, float32* confidence)
 {
 	if (!is_initialized_) {
 		return false;
@@ -99,7 +154,7 @@ bool ADCensusStereo::Match(const uint8* img_left, const uint8* img_right, float3
 	start = steady_clock::now();
 
 	// ɨ�����Ż�
-	ScanlineOptimize();
+	ScanlineOptimize(confidence);
 
 	end = steady_clock::now();
 	tt = duration_cast<milliseconds>(end - start);
@@ -107,8 +162,9 @@ bool ADCensusStereo::Match(const uint8* img_left, const uint8* img_right, float3
 	start = steady_clock::now();
 
 	// ����������ͼ�Ӳ�
-	ComputeDisparity();
-	ComputeDisparityRight();
+	if (!FusedWta()) {
+		ComputeDisparity(confidence);
+	}
 
 	end = steady_clock::now();
 	tt = duration_cast<milliseconds>(end - start);
@@ -159,19 +215,27 @@ void ADCensusStereo::ComputeCost()
 void ADCensusStereo::CostAggregation()
 {
 	// ���þۺ�������
-	aggregator_.SetData(img_left_, img_right_, cost_computer_.get_cost_ptr());
+	aggregator_.SetData(img_left_, img_right_, cost_computer_.get_cost_volume());
 	// ���þۺ�������
-	aggregator_.SetParams(option_.cross_L1, option_.cross_L2, option_.cross_t1, option_.cross_t2);
+	aggregator_.SetParams(option_.cross_L1, option_.cross_L2, option_.cross_t1, option_.cross_t2, option_.cross_aggr_method);
 	// ���۾ۺ�
-	aggregator_.Aggregate(4);
+	aggregator_.Aggregate(option_.num_iters);
 }
 
-void ADCensusStereo::ScanlineOptimize()
+void ADCensusStereo::ScanlineOptimize(float32* confidence)
 {
 	// �����Ż�������
-	scan_line_.SetData(img_left_, img_right_, cost_computer_.get_cost_ptr(), aggregator_.get_cost_ptr());
+	scan_line_.SetData(img_left_, img_right_, cost_computer_.get_cost_volume(), aggregator_.get_cost_volume());
 	// �����Ż�������
-	scan_line_.SetParam(width_, height_, option_.min_disparity, option_.max_disparity, option_.so_p1, option_.so_p2, option_.so_tso);
+	scan_line_.SetParam(width_, height_, option_.min_disparity, option_.max_disparity, option_.so_p1, option_.so_p2, option_.so_tso,
+		option_.so_num_paths, option_.so_fixed_point);
+	// the fused last pass writes the disparities instead of the costs
+	if (FusedWta()) {
+		scan_line_.SetDisparityOutput(disp_left_, option_.do_lr_check ? disp_right_ : nullptr, confidence, option_.confidence_measure);
+	}
+	else {
+		scan_line_.SetDisparityOutput(nullptr, nullptr);
+	}
 	// ɨ�����Ż�
 	scan_line_.Optimize();
 }
@@ -179,7 +243,7 @@ void ADCensusStereo::ScanlineOptimize()
 void ADCensusStereo::MultiStepRefine()
 {
 	// ���öಽ�Ż�������
-	refiner_.SetData(img_left_, aggregator_.get_cost_ptr(), aggregator_.get_arms_ptr(), disp_left_, disp_right_);
+	refiner_.SetData(img_left_, aggregator_.get_cost_volume(), aggregator_.get_arms_ptr(), disp_left_, disp_right_);
 	// ���öಽ�Ż�������
 	refiner_.SetParam(option_.min_disparity, option_.max_disparity, option_.irv_ts, option_.irv_th, option_.lrcheck_thres,
 					  option_.do_lr_check,option_.do_filling,option_.do_filling, option_.do_discontinuity_adjustment);
@@ -187,65 +251,29 @@ void ADCensusStereo::MultiStepRefine()
 	refiner_.Refine();
 }
 
-void ADCensusStereo::ComputeDisparity()
+void ADCensusStereo::ComputeDisparity(float32* confidence)
 {
-	const sint32& min_disparity = option_.min_disparity;
-	const sint32& max_disparity = option_.max_disparity;
-	const sint32 disp_range = max_disparity - min_disparity;
-	if (disp_range <= 0) {
-		return;
-	}
-
-	// ��Ӱ���Ӳ�ͼ
-	const auto disparity = disp_left_;
-	// ��Ӱ��ۺϴ�������
-	const auto cost_ptr = aggregator_.get_cost_ptr();
-
-	const sint32 width = width_;
-	const sint32 height = height_;
-
-	// Ϊ�˼ӿ��ȡЧ�ʣ��ѵ������ص����д���ֵ�洢���ֲ�������
-	std::vector<float32> cost_local(disp_range);
-
-	// ---�����ؼ��������Ӳ�
-	for (sint32 i = 0; i < height; i++) {
-		for (sint32 j = 0; j < width; j++) {
-			float32 min_cost = Large_Float;
-			sint32 best_disparity = 0;
-
-			// ---�����ӲΧ�ڵ����д���ֵ�������С����ֵ����Ӧ���Ӳ�ֵ
-			for (sint32 d = min_disparity; d < max_disparity; d++) {
-				const sint32 d_idx = d - min_disparity;
-				const auto& cost = cost_local[d_idx] = cost_ptr[i * width * disp_range + j * disp_range + d_idx];
-				if (min_cost > cost) {
-					min_cost = cost;
-					best_disparity = d;
-				}
-			}
-			// ---���������
-			if (best_disparity == min_disparity || best_disparity == max_disparity - 1) {
-				disparity[i * width + j] = Invalid_Float;
-				continue;
-			}
-			// �����Ӳ�ǰһ���Ӳ�Ĵ���ֵcost_1����һ���Ӳ�Ĵ���ֵcost_2
-			const sint32 idx_1 = best_disparity - 1 - min_disparity;
-			const sint32 idx_2 = best_disparity + 1 - min_disparity;
-			const float32 cost_1 = cost_local[idx_1];
-			const float32 cost_2 = cost_local[idx_2];
-			// ��һԪ�������߼�ֵ
-			const float32 denom = cost_1 + cost_2 - 2 * min_cost;
-			if (denom != 0.0f) {
-				disparity[i * width + j] = static_cast<float32>(best_disparity) + (cost_1 - cost_2) / (denom * 2.0f);
-			}
-			else {
-				disparity[i * width + j] = static_cast<float32>(best_disparity);
-			}
-		}
+	const auto cost = aggregator_.get_cost_volume();
+	switch (cost->type()) {
+	case CostUInt16:
+		ComputeDisparity(cost->ptr<uint16>(), confidence);
+		break;
+	case CostUInt8:
+		ComputeDisparity(cost->ptr<uint8>(), confidence);
+		break;
+	default:
+		ComputeDisparity(cost->ptr<float32>(), confidence);
+		break;
 	}
 }
 
-void ADCensusStereo::ComputeDisparityRight()
+template<typename T>
+void ADCensusStereo::ComputeDisparity(const T* cost_ptr, float32* confidence)
 {
+	if (cost_ptr == nullptr) {
+		return;
+	}
+
 	const sint32& min_disparity = option_.min_disparity;
 	const sint32& max_disparity = option_.max_disparity;
 	const sint32 disp_range = max_disparity - min_disparity;
@@ -253,67 +281,43 @@ void ADCensusStereo::ComputeDisparityRight()
 		return;
 	}
 
-	// ��Ӱ���Ӳ�ͼ
-	const auto disparity = disp_right_;
-	// ��Ӱ��ۺϴ�������
-	const auto cost_ptr = aggregator_.get_cost_ptr();
-
 	const sint32 width = width_;
 	const sint32 height = height_;
-
-	// Ϊ�˼ӿ��ȡЧ�ʣ��ѵ������ص����д���ֵ�洢���ֲ�������
-	std::vector<float32> cost_local(disp_range);
-
-	// ---�����ؼ��������Ӳ�
-	// ͨ����Ӱ��Ĵ��ۣ���ȡ��Ӱ��Ĵ���
-	// ��cost(xr,yr,d) = ��cost(xr+d,yl,d)
-	for (sint32 i = 0; i < height; i++) {
-		for (sint32 j = 0; j < width; j++) {
-			float32 min_cost = Large_Float;
-			sint32 best_disparity = 0;
-
-			// ---ͳ�ƺ�ѡ�Ӳ��µĴ���ֵ
-			for (sint32 d = min_disparity; d < max_disparity; d++) {
-				const sint32 d_idx = d - min_disparity;
-				const sint32 col_left = j + d;
-				if (col_left >= 0 && col_left < width) {
-					const auto& cost = cost_local[d_idx] = cost_ptr[i * width * disp_range + col_left * disp_range + d_idx];
-					if (min_cost > cost) {
-						min_cost = cost;
-						best_disparity = d;
-					}
-				}
-				else {
-					cost_local[d_idx] = Large_Float;
-				}
-			}
-
-			// ---���������
-			if (best_disparity == min_disparity || best_disparity == max_disparity - 1) {
-				disparity[i * width + j] = best_disparity;
-				continue;
-			}
-
-			// �����Ӳ�ǰһ���Ӳ�Ĵ���ֵcost_1����һ���Ӳ�Ĵ���ֵcost_2
-			const sint32 idx_1 = best_disparity - 1 - min_disparity;
-			const sint32 idx_2 = best_disparity + 1 - min_disparity;
-			const float32 cost_1 = cost_local[idx_1];
-			const float32 cost_2 = cost_local[idx_2];
-			// ��һԪ�������߼�ֵ
-			const float32 denom = cost_1 + cost_2 - 2 * min_cost;
-			if (denom != 0.0f) {
-				disparity[i * width + j] = static_cast<float32>(best_disparity) + (cost_1 - cost_2) / (denom * 2.0f);
-			}
-			else {
-				disparity[i * width + j] = static_cast<float32>(best_disparity);
-			}
+	// the right view is only used by the left-right check
+	float32* disp_right = option_.do_lr_check ? disp_right_ : nullptr;
+
+	// the rows are independent, each thread uses its own row of float32 costs and right view min buffer
+	ThreadPool::ParallelFor(&thread_pool_, 0, height, [&](const sint32& row_begin, const sint32& row_end, const sint32& thread_id) {
+		float32* row_buffer = wta_row_costs_ != nullptr ? wta_row_costs_ + static_cast<size_t>(thread_id) * width * disp_range : nullptr;
+		float32* right_min = wta_right_min_ + thread_id * width;
+		sint32* right_best = wta_right_best_ + thread_id * width;
+		for (sint32 i = row_begin; i < row_end; i++) {
+			const float32* row_costs = LoadRowCosts(cost_ptr + i * width * disp_range, width * disp_range, row_buffer);
+			adcensus_util::ComputeDisparityRow(row_costs, width, min_disparity, max_disparity, 0, width,
+				disp_left_ + i * width, disp_right != nullptr ? disp_right + i * width : nullptr, right_min, right_best,
+				confidence != nullptr ? confidence + i * width : nullptr, option_.confidence_measure);
 		}
-	}
+	});
+}
+
+bool ADCensusStereo::FusedWta() const
+{
+	return option_.so_fused_wta && !option_.do_discontinuity_adjustment;
+}
+
+size_t ADCensusStereo::get_memory_footprint() const
+{
+	return arena_.footprint();
 }
 
 void ADCensusStereo::Release()
 {
-	SAFE_DELETE(disp_left_);
-	SAFE_DELETE(disp_right_);
+	// the disparity maps, the buffers of ComputeDisparity and those of the steps belong to the arena
+	disp_left_ = nullptr;
+	disp_right_ = nullptr;
+	wta_row_costs_ = nullptr;
+	wta_right_min_ = nullptr;
+	wta_right_best_ = nullptr;
+	arena_.Release();
 }
 
@@ -32,6 +32,17 @@ public:
 	*/
 	bool Match(const uint8* img_left, const uint8* img_right, float32* disp_left);
 
+	/**
+	* \brief match and output the confidence of the winner-take-all disparities, see ConfidenceMeasure
+	* The confidence belongs to the disparities before the multistep refinement, it is computed while
+	* the disparities are picked and needs no extra pass over the cost volume.
+	* \param img_left		input, left image, 3 channels
+	* \param img_right		input, right image, 3 channels
+	* \param disp_left		output, left disparity map, allocated by the caller with the image size
+	* \param confidence	output, confidence map, allocated by the caller with the image size, nullptr: no confidence
+	*/
+	bool Match(const uint8* img_left, const uint8* img_right, float32* disp_left, float32* confidence);
+
 	/**
 	* \brief 
 	* \param width		룬Ӱ
@@ -40,6 +51,15 @@ public:
 	*/
 	bool Reset(const uint32& width, const uint32& height, const ADCensusOption& option);
 
+	/**
+	* \brief bytes of the arena: the initial and aggregated cost volumes, the disparity maps, the arms, support counts,
+	* per thread slices, integral images and color planes of the aggregation, the label plane, edge rows and histograms
+	* of the refinement and the per thread buffers of ComputeDisparity.
+	* Not counted: the census and row buffers of the cost computation, the penalty maps and path buffers of the
+	* scanline optimization and the write lists of the refinement, which the steps size per frame themselves.
+	*/
+	size_t get_memory_footprint() const;
+
 private:
 	/** \brief ۼ */
 	void ComputeCost();
@@ -47,17 +67,20 @@ private:
 	/** \brief ۾ۺ */
 	void CostAggregation();
 
-	/** \brief ɨŻ	 */
-	void ScanlineOptimize();
+	/** \brief ɨŻ, confidence: nullptr or the confidence output of the fused last pass */
+	void ScanlineOptimize(float32* confidence);
 
 	/** \brief ಽӲŻ	*/
 	void MultiStepRefine();
 
-	/** \brief Ӳ㣨ͼ*/
-	void ComputeDisparity();
+	/** \brief Ӳ㣨ͼһԼͼconfidence: nullptr or the confidence output */
+	void ComputeDisparity(float32* confidence);
+	/** \brief disparities of the left view, and of the right view for the left-right check, on a cost volume of storage type T */
+	template<typename T>
+	void ComputeDisparity(const T* cost_ptr, float32* confidence);
 
-	/** \brief Ӳ㣨ͼ*/
-	void ComputeDisparityRight();
+	/** \brief the disparities are computed in the last scanline pass: so_fused_wta without discontinuity adjustment, which needs the volume */
+	bool FusedWta() const;
 
 	/** \brief ڴͷ */
 	void Release();
@@ -84,12 +107,22 @@ private:
 	ScanlineOptimizer scan_line_;
 	/** \brief ಽŻ */
 	MultiStepRefiner refiner_;
+	/** \brief thread pool shared by all the steps */
+	ThreadPool thread_pool_;
+	/** \brief arena of the cost volumes, the disparity maps and the buffers of the steps, see get_memory_footprint */
+	MemoryArena arena_;
 
 	/** \brief ӰӲͼ */
 	float32* disp_left_;
 	/** \brief ӰӲͼ */
 	float32* disp_right_;
 
+	/** \brief a row of float32 costs per thread for ComputeDisparity, nullptr for the float32 volume or the fused winner-take-all */
+	float32* wta_row_costs_;
+	/** \brief the right view min buffers of a row per thread for ComputeDisparity */
+	float32* wta_right_min_;
+	sint32* wta_right_best_;
+
 	/** \brief Ƿʼ־	*/
 	bool is_initialized_;
 };
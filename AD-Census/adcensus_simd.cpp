@@ -0,0 +1,82 @@
+/* -*-c++-*- AD-Census - Copyright (C) 2020.
+* Author	: Yingsong Li(Ethan Li) <ethan.li.whu@gmail.com>
+* https://github.com/ethan-li-coding/AD-Census
+* Describe	: implement of simd helpers
+*/
+
+#include "adcensus_simd.h"
+
+#if defined(ADCENSUS_X86)
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+namespace
+{
+#if defined(ADCENSUS_X86)
+	void CpuId(const sint32& leaf, const sint32& sub_leaf, uint32 regs[4])
+	{
+#if defined(_MSC_VER)
+		int info[4];
+		__cpuidex(info, leaf, sub_leaf);
+		for (sint32 k = 0; k < 4; k++) {
+			regs[k] = static_cast<uint32>(info[k]);
+		}
+#else
+		__cpuid_count(leaf, sub_leaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+	}
+
+	uint64 XGetBv()
+	{
+#if defined(_MSC_VER)
+		return _xgetbv(0);
+#else
+		uint32 eax, edx;
+		__asm__ __volatile__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+		return (static_cast<uint64>(edx) << 32) | eax;
+#endif
+	}
+#endif
+
+	adcensus_simd::CpuFeatures DetectCpuFeatures()
+	{
+		adcensus_simd::CpuFeatures features = { false, false, false, false };
+#if defined(ADCENSUS_X86)
+		uint32 regs[4];
+		CpuId(0, 0, regs);
+		const uint32 max_leaf = regs[0];
+		if (max_leaf < 1) {
+			return features;
+		}
+
+		CpuId(1, 0, regs);
+		features.popcnt = (regs[2] & (1u << 23)) != 0;
+		const bool osxsave = (regs[2] & (1u << 27)) != 0;
+		const bool avx = (regs[2] & (1u << 28)) != 0;
+		if (!osxsave || !avx || max_leaf < 7) {
+			return features;
+		}
+
+		// the os must save the ymm(bit 1,2) / zmm(bit 5,6,7) states on context switch
+		const uint64 xcr0 = XGetBv();
+		const bool os_ymm = (xcr0 & 0x06) == 0x06;
+		const bool os_zmm = (xcr0 & 0xe6) == 0xe6;
+
+		CpuId(7, 0, regs);
+		features.avx2 = os_ymm && (regs[1] & (1u << 5)) != 0;
+		features.avx512bw = os_zmm && features.avx2 && (regs[1] & (1u << 16)) != 0 && (regs[1] & (1u << 30)) != 0;
+		features.avx512vpopcntdq = features.avx512bw && (regs[2] & (1u << 14)) != 0;
+#endif
+		return features;
+	}
+}
+
+const adcensus_simd::CpuFeatures& adcensus_simd::GetCpuFeatures()
+{
+	static const CpuFeatures features = DetectCpuFeatures();
+	return features;
+}
@@ -0,0 +1,66 @@
+/* -*-c++-*- AD-Census - Copyright (C) 2020.
+* Author	: Yingsong Li(Ethan Li) <ethan.li.whu@gmail.com>
+* https://github.com/ethan-li-coding/AD-Census
+* Describe	: header of simd helpers (compiler target attributes and cpu feature detection)
+*/
+
+#ifndef AD_CENSUS_SIMD_H_
+#define AD_CENSUS_SIMD_H_
+
+#include "adcensus_types.h"
+
+/**
+* \brief SIMD kernels are compiled per function with target attributes and selected at runtime,
+* so the library itself does not need to be built with -mavx2 / /arch:AVX2.
+* On non-x86 platforms only the scalar paths are compiled.
+*/
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define ADCENSUS_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(ADCENSUS_X86) && (defined(__GNUC__) || defined(__clang__))
+#define ADCENSUS_TARGET_POPCNT			__attribute__((target("popcnt")))
+#define ADCENSUS_TARGET_AVX2			__attribute__((target("avx2,popcnt")))
+#define ADCENSUS_TARGET_AVX512			__attribute__((target("avx2,popcnt,avx512f,avx512bw")))
+#define ADCENSUS_TARGET_AVX512_VPOPCNT	__attribute__((target("avx2,popcnt,avx512f,avx512bw,avx512vpopcntdq")))
+#elif defined(ADCENSUS_X86)
+#define ADCENSUS_TARGET_POPCNT
+#define ADCENSUS_TARGET_AVX2
+#define ADCENSUS_TARGET_AVX512
+#define ADCENSUS_TARGET_AVX512_VPOPCNT
+#endif
+
+#if defined(ADCENSUS_X86) && defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace adcensus_simd
+{
+	/** \brief cpu features usable by the kernels (already checked against os support) */
+	struct CpuFeatures {
+		bool popcnt;			// POPCNT
+		bool avx2;				// AVX2
+		bool avx512bw;			// AVX-512 F + BW
+		bool avx512vpopcntdq;	// AVX-512 VPOPCNTDQ
+	};
+
+	/** \brief query the cpu features once, later calls return the cached result */
+	const CpuFeatures& GetCpuFeatures();
+
+#if defined(ADCENSUS_X86)
+	/** \brief hardware popcount, only valid when GetCpuFeatures().popcnt is set */
+	ADCENSUS_TARGET_POPCNT
+	inline uint32 Popcnt64(const uint64& x) {
+#if defined(_MSC_VER) && defined(_M_X64)
+		return static_cast<uint32>(__popcnt64(x));
+#elif defined(_MSC_VER)
+		return __popcnt(static_cast<uint32>(x)) + __popcnt(static_cast<uint32>(x >> 32));
+#else
+		return static_cast<uint32>(__builtin_popcountll(x));
+#endif
+	}
+#endif
+}
+
+#endif
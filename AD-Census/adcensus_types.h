@@ -41,6 +41,53 @@ enum CensusSize {
 	Census9x7
 };
 
+/**
+* \brief cost volume storage type
+* The fixed point types store round(cost * scale), see CostTraits in cost_volume.h:
+*   CostUInt16: scale 4096, costs in [0,16) in steps of 1/4096, half the memory of float32
+*   CostUInt8 : scale 128,  costs in [0,2)  in steps of 1/128, a quarter of the memory of float32
+* Larger costs saturate at the top of the range.
+*/
+enum CostType {
+	CostFloat32 = 0,
+	CostUInt16,
+	CostUInt8
+};
+
+/**
+* \brief cost volume memory layout
+*   CostPixelMajor    : (y * width + x) * disp_range + d, the costs of one pixel are contiguous
+*   CostDisparityMajor: (d * height + y) * width + x, the costs of one disparity (a slice) are contiguous
+* The layout only applies to the initial cost volume, the cross aggregation works on it slice by slice
+* and transposes the result to pixel-major for the scanline optimization and the disparity computation.
+*/
+enum CostLayout {
+	CostPixelMajor = 0,
+	CostDisparityMajor
+};
+
+/**
+* \brief cross-based cost aggregation method
+*   CrossAggrDirect  : sums the costs along every arm pixel by pixel, O(arm length) per pixel
+*   CrossAggrIntegral: orthogonal integral images, each arm sum is the difference of two row or column prefix sums, O(1) per pixel
+* Both give the same aggregated costs up to float rounding.
+*/
+enum CrossAggrMethod {
+	CrossAggrDirect = 0,
+	CrossAggrIntegral
+};
+
+/**
+* \brief confidence of the winner-take-all disparity of a pixel, from its costs c after the scanline optimization
+*   ConfidencePeakRatio : 1 - c(d) / c2, c2 the min cost outside of d - 1..d + 1, in [0,1]
+*   ConfidenceCurvature : c(d - 1) + c(d + 1) - 2 * c(d), the curvature of the sub-pixel parabola, >= 0
+* d is the disparity of the min cost, pixels without a valid disparity have confidence 0.
+*/
+enum ConfidenceMeasure {
+	ConfidencePeakRatio = 0,
+	ConfidenceCurvature
+};
+
 /** \brief ADCensusṹ */
 struct ADCensusOption {
 	sint32  min_disparity;		// СӲ
@@ -55,6 +102,9 @@ struct ADCensusOption {
 	float32	so_p1;				// ɨŻp1
 	float32	so_p2;				// ɨŻp2
 	sint32	so_tso;				// ɨŻtso
+	sint32	so_num_paths;		// scanline optimization paths: 4, 8 (+ diagonals) or 16 (+ knight moves)
+	bool	so_fixed_point;		// scanline optimization on uint16 fixed point path costs instead of float32
+	bool	so_fused_wta;		// compute the disparities in the last scanline pass, only without discontinuity adjustment
 	sint32	irv_ts;				// Iterative Region Votingts
 	float32 irv_th;				// Iterative Region Votingth
 	
@@ -63,15 +113,28 @@ struct ADCensusOption {
 	bool	do_lr_check;					// Ƿһ
 	bool	do_filling;						// ǷӲ
 	bool	do_discontinuity_adjustment;	// Ƿ
+
+	CostType cost_type;						// cost volume storage type
+	CostLayout cost_layout;					// initial cost volume layout
+	CrossAggrMethod cross_aggr_method;		// cross aggregation method
+	sint32	num_iters;						// cross aggregation iterations
+	ConfidenceMeasure confidence_measure;	// confidence output of Match
+
+	sint32	num_threads;					// number of threads, <= 0: all hardware threads
+	bool	huge_pages;						// back the cost volumes and disparity maps with transparent huge pages (Linux)
 	
 	ADCensusOption(): min_disparity(0), max_disparity(64),
 	                  lambda_ad(10), lambda_census(30),
 	                  cross_L1(34), cross_L2(17),
 	                  cross_t1(20), cross_t2(6),
 	                  so_p1(1.0f), so_p2(3.0f),
-	                  so_tso(15), irv_ts(20), irv_th(0.4f),
+	                  so_tso(15), so_num_paths(4), so_fixed_point(false), so_fused_wta(false), irv_ts(20), irv_th(0.4f),
 	                  lrcheck_thres(1.0f),
-					  do_lr_check(true), do_filling(true), do_discontinuity_adjustment(false) {} ;
+					  do_lr_check(true), do_filling(true), do_discontinuity_adjustment(false),
+					  cost_type(CostFloat32), cost_layout(CostPixelMajor),
+					  cross_aggr_method(CrossAggrDirect), num_iters(4),
+					  confidence_measure(ConfidencePeakRatio),
+					  num_threads(1), huge_pages(false) {} ;
 };
 
 /**
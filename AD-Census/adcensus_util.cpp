@@ -5,35 +5,529 @@
 */
 
 #include "adcensus_util.h"
+#include "adcensus_simd.h"
+#include <algorithm>
 #include <cassert>
+#include <cmath>
+#include <cstring>
 
-void adcensus_util::census_transform_9x7(const uint8* source, vector<uint64>& census, const sint32& width, const sint32& height)
+namespace
 {
-	if (source == nullptr || census.empty() || width <= 9 || height <= 7) {
-		return;
+	/** \brief census value of the pixel (i,j), neighbours are packed row by row with the first one in the highest bit */
+	inline uint64 census_9x7_pixel(const uint8* source, const sint32& width, const sint32& i, const sint32& j)
+	{
+		// ֵ
+		const uint8 gray_center = source[i * width + j];
+
+		// СΪ9x7ĴأһȽֵֵĵĴСcensusֵ
+		uint64 census_val = 0u;
+		for (sint32 r = -4; r <= 4; r++) {
+			for (sint32 c = -3; c <= 3; c++) {
+				census_val <<= 1;
+				const uint8 gray = source[(i + r) * width + j + c];
+				if (gray < gray_center) {
+					census_val += 1;
+				}
+			}
+		}
+		return census_val;
 	}
 
-	// ؼcensusֵ
-	for (sint32 i = 4; i < height - 4; i++) {
-		for (sint32 j = 3; j < width - 3; j++) {
+#if defined(ADCENSUS_X86)
+	/*
+	* The simd kernels evaluate one neighbour offset for a whole block of pixels with a single byte compare.
+	* The compare results are shifted into one byte per pixel, 8 offsets per byte (the first byte holds 7),
+	* and the 8 byte planes are finally transposed into one uint64 per pixel. The first offset ends up in
+	* the highest bit, exactly as in census_9x7_pixel.
+	*/
 
-			// ֵ
-			const uint8 gray_center = source[i * width + j];
+	/**
+	* \brief census of 32 pixels at a time in row i, starting at column 3
+	* \return the first column that is left for the scalar code
+	*/
+	ADCENSUS_TARGET_AVX2
+	sint32 census_row_9x7_avx2(const uint8* source, uint64* census, const sint32& width, const sint32& i)
+	{
+		const __m256i sign = _mm256_set1_epi8(static_cast<char>(0x80));
+		sint32 j = 3;
+		for (; j + 32 <= width - 3; j += 32) {
+			// unsigned compare via signed compare on sign-flipped bytes
+			const __m256i center = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + i * width + j)), sign);
+			__m256i planes[8];
+			__m256i acc = _mm256_setzero_si256();
+			sint32 k = 0;
+			for (sint32 r = -4; r <= 4; r++) {
+				const uint8* row = source + (i + r) * width + j;
+				for (sint32 c = -3; c <= 3; c++) {
+					const __m256i gray = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + c)), sign);
+					// lt is 0xff where gray < center, acc = acc * 2 + bit
+					const __m256i lt = _mm256_cmpgt_epi8(center, gray);
+					acc = _mm256_sub_epi8(_mm256_add_epi8(acc, acc), lt);
+					if (++k % 8 == 7) {
+						planes[k / 8] = acc;
+						acc = _mm256_setzero_si256();
+					}
+				}
+			}
 
-			// СΪ9x7ĴأһȽֵֵĵĴСcensusֵ
-			uint64 census_val = 0u;
+			// byte transpose, plane 0 is the most significant byte
+			const __m256i t0 = _mm256_unpacklo_epi8(planes[7], planes[6]);
+			const __m256i t1 = _mm256_unpackhi_epi8(planes[7], planes[6]);
+			const __m256i t2 = _mm256_unpacklo_epi8(planes[5], planes[4]);
+			const __m256i t3 = _mm256_unpackhi_epi8(planes[5], planes[4]);
+			const __m256i t4 = _mm256_unpacklo_epi8(planes[3], planes[2]);
+			const __m256i t5 = _mm256_unpackhi_epi8(planes[3], planes[2]);
+			const __m256i t6 = _mm256_unpacklo_epi8(planes[1], planes[0]);
+			const __m256i t7 = _mm256_unpackhi_epi8(planes[1], planes[0]);
+			const __m256i u0 = _mm256_unpacklo_epi16(t0, t2);
+			const __m256i u1 = _mm256_unpackhi_epi16(t0, t2);
+			const __m256i u2 = _mm256_unpacklo_epi16(t1, t3);
+			const __m256i u3 = _mm256_unpackhi_epi16(t1, t3);
+			const __m256i w0 = _mm256_unpacklo_epi16(t4, t6);
+			const __m256i w1 = _mm256_unpackhi_epi16(t4, t6);
+			const __m256i w2 = _mm256_unpacklo_epi16(t5, t7);
+			const __m256i w3 = _mm256_unpackhi_epi16(t5, t7);
+			// q[n] holds the pixels 2n,2n+1 (low lane) and 16+2n,16+2n+1 (high lane)
+			const __m256i q[8] = {
+				_mm256_unpacklo_epi32(u0, w0), _mm256_unpackhi_epi32(u0, w0),
+				_mm256_unpacklo_epi32(u1, w1), _mm256_unpackhi_epi32(u1, w1),
+				_mm256_unpacklo_epi32(u2, w2), _mm256_unpackhi_epi32(u2, w2),
+				_mm256_unpacklo_epi32(u3, w3), _mm256_unpackhi_epi32(u3, w3)
+			};
+			uint64* dst = census + i * width + j;
+			for (sint32 n = 0; n < 4; n++) {
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + 4 * n), _mm256_permute2x128_si256(q[2 * n], q[2 * n + 1], 0x20));
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + 16 + 4 * n), _mm256_permute2x128_si256(q[2 * n], q[2 * n + 1], 0x31));
+			}
+		}
+		return j;
+	}
+
+	/**
+	* \brief census of 64 pixels at a time in row i, starting at column 3
+	* \return the first column that is left for the scalar code
+	*/
+	ADCENSUS_TARGET_AVX512
+	sint32 census_row_9x7_avx512(const uint8* source, uint64* census, const sint32& width, const sint32& i)
+	{
+		const __m512i one = _mm512_set1_epi8(1);
+		sint32 j = 3;
+		for (; j + 64 <= width - 3; j += 64) {
+			const __m512i center = _mm512_loadu_si512(source + i * width + j);
+			__m512i planes[8];
+			__m512i acc = _mm512_setzero_si512();
+			sint32 k = 0;
 			for (sint32 r = -4; r <= 4; r++) {
+				const uint8* row = source + (i + r) * width + j;
 				for (sint32 c = -3; c <= 3; c++) {
-					census_val <<= 1;
-					const uint8 gray = source[(i + r) * width + j + c];
-					if (gray < gray_center) {
-						census_val += 1;
+					const __m512i gray = _mm512_loadu_si512(row + c);
+					const __mmask64 lt = _mm512_cmplt_epu8_mask(gray, center);
+					acc = _mm512_add_epi8(acc, acc);
+					acc = _mm512_mask_add_epi8(acc, lt, acc, one);
+					if (++k % 8 == 7) {
+						planes[k / 8] = acc;
+						acc = _mm512_setzero_si512();
+					}
+				}
+			}
+
+			const __m512i t0 = _mm512_unpacklo_epi8(planes[7], planes[6]);
+			const __m512i t1 = _mm512_unpackhi_epi8(planes[7], planes[6]);
+			const __m512i t2 = _mm512_unpacklo_epi8(planes[5], planes[4]);
+			const __m512i t3 = _mm512_unpackhi_epi8(planes[5], planes[4]);
+			const __m512i t4 = _mm512_unpacklo_epi8(planes[3], planes[2]);
+			const __m512i t5 = _mm512_unpackhi_epi8(planes[3], planes[2]);
+			const __m512i t6 = _mm512_unpacklo_epi8(planes[1], planes[0]);
+			const __m512i t7 = _mm512_unpackhi_epi8(planes[1], planes[0]);
+			const __m512i u0 = _mm512_unpacklo_epi16(t0, t2);
+			const __m512i u1 = _mm512_unpackhi_epi16(t0, t2);
+			const __m512i u2 = _mm512_unpacklo_epi16(t1, t3);
+			const __m512i u3 = _mm512_unpackhi_epi16(t1, t3);
+			const __m512i w0 = _mm512_unpacklo_epi16(t4, t6);
+			const __m512i w1 = _mm512_unpackhi_epi16(t4, t6);
+			const __m512i w2 = _mm512_unpacklo_epi16(t5, t7);
+			const __m512i w3 = _mm512_unpackhi_epi16(t5, t7);
+			// q[n] holds the pixels 16L+2n,16L+2n+1 in 128-bit lane L
+			const __m512i q[8] = {
+				_mm512_unpacklo_epi32(u0, w0), _mm512_unpackhi_epi32(u0, w0),
+				_mm512_unpacklo_epi32(u1, w1), _mm512_unpackhi_epi32(u1, w1),
+				_mm512_unpacklo_epi32(u2, w2), _mm512_unpackhi_epi32(u2, w2),
+				_mm512_unpacklo_epi32(u3, w3), _mm512_unpackhi_epi32(u3, w3)
+			};
+			uint64* dst = census + i * width + j;
+			for (sint32 h = 0; h < 2; h++) {
+				// gather lane L of q[4h..4h+3] into the 8 pixels 16L+8h..16L+8h+7
+				const __m512i x01 = _mm512_shuffle_i64x2(q[4 * h], q[4 * h + 1], _MM_SHUFFLE(1, 0, 1, 0));
+				const __m512i x23 = _mm512_shuffle_i64x2(q[4 * h + 2], q[4 * h + 3], _MM_SHUFFLE(1, 0, 1, 0));
+				const __m512i y01 = _mm512_shuffle_i64x2(q[4 * h], q[4 * h + 1], _MM_SHUFFLE(3, 2, 3, 2));
+				const __m512i y23 = _mm512_shuffle_i64x2(q[4 * h + 2], q[4 * h + 3], _MM_SHUFFLE(3, 2, 3, 2));
+				_mm512_storeu_si512(dst + 8 * h, _mm512_shuffle_i64x2(x01, x23, _MM_SHUFFLE(2, 0, 2, 0)));
+				_mm512_storeu_si512(dst + 16 + 8 * h, _mm512_shuffle_i64x2(x01, x23, _MM_SHUFFLE(3, 1, 3, 1)));
+				_mm512_storeu_si512(dst + 32 + 8 * h, _mm512_shuffle_i64x2(y01, y23, _MM_SHUFFLE(2, 0, 2, 0)));
+				_mm512_storeu_si512(dst + 48 + 8 * h, _mm512_shuffle_i64x2(y01, y23, _MM_SHUFFLE(3, 1, 3, 1)));
+			}
+		}
+		return j;
+	}
+#endif
+
+	/**
+	* \brief first min of costs[0..n) that is below Large_Float
+	* \return index of the min, -1 if there is none
+	*/
+	typedef sint32(*ArgMinFunc)(const float32* costs, const sint32& n, float32& min_cost);
+
+	/**
+	* \brief ArgMinFunc that also finds second_cost, the min of the costs outside of best - 1..best + 1, in the same sweep
+	* \return index of the min, -1 if there is none
+	*/
+	typedef sint32(*ArgMinSecondFunc)(const float32* costs, const sint32& n, float32& min_cost, float32& second_cost);
+
+	/**
+	* \brief running min of the right view: costs[k] at disparity d_begin + k belongs to right pixel -k,
+	* right_min[-k] and right_best[-k] take it if it is smaller
+	*/
+	typedef void(*RightMinFunc)(const float32* costs, const sint32& n, const sint32& d_begin, float32* right_min, sint32* right_best);
+
+	sint32 ArgMinScalar(const float32* costs, const sint32& n, float32& min_cost)
+	{
+		min_cost = Large_Float;
+		sint32 best = -1;
+		for (sint32 k = 0; k < n; k++) {
+			if (min_cost > costs[k]) {
+				min_cost = costs[k];
+				best = k;
+			}
+		}
+		return best;
+	}
+
+	sint32 ArgMinSecondScalar(const float32* costs, const sint32& n, float32& min_cost, float32& second_cost)
+	{
+		// low: min of costs[0..best - 2] taken when best was found, high: min of costs[best + 2..k], before: min of costs[0..k - 2]
+		float32 low = Large_Float, high = Large_Float, before = Large_Float;
+		min_cost = Large_Float;
+		sint32 best = -1;
+		for (sint32 k = 0; k < n; k++) {
+			if (k >= 2) {
+				before = std::min(before, costs[k - 2]);
+			}
+			if (min_cost > costs[k]) {
+				min_cost = costs[k];
+				best = k;
+				low = before;
+				high = Large_Float;
+			}
+			else if (k >= best + 2) {
+				high = std::min(high, costs[k]);
+			}
+		}
+		second_cost = std::min(low, high);
+		return best;
+	}
+
+	void RightMinScalar(const float32* costs, const sint32& n, const sint32& d_begin, float32* right_min, sint32* right_best)
+	{
+		for (sint32 k = 0; k < n; k++) {
+			if (right_min[-k] > costs[k]) {
+				right_min[-k] = costs[k];
+				right_best[-k] = d_begin + k;
+			}
+		}
+	}
+
+#if defined(ADCENSUS_X86)
+	/** \brief 8 costs per iteration, every lane keeps its first min and index, the lanes are reduced at the end */
+	ADCENSUS_TARGET_AVX2
+	sint32 ArgMinAvx2(const float32* costs, const sint32& n, float32& min_cost)
+	{
+		__m256 min_v = _mm256_set1_ps(Large_Float);
+		__m256i best_v = _mm256_set1_epi32(-1);
+		__m256i index_v = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+		const __m256i step = _mm256_set1_epi32(8);
+		sint32 k = 0;
+		for (; k + 8 <= n; k += 8) {
+			const __m256 c = _mm256_loadu_ps(costs + k);
+			const __m256 lt = _mm256_cmp_ps(c, min_v, _CMP_LT_OQ);
+			min_v = _mm256_blendv_ps(min_v, c, lt);
+			best_v = _mm256_blendv_epi8(best_v, index_v, _mm256_castps_si256(lt));
+			index_v = _mm256_add_epi32(index_v, step);
+		}
+
+		// the smallest index among the lanes that hold the min is the first min
+		float32 mins[8];
+		sint32 bests[8];
+		_mm256_storeu_ps(mins, min_v);
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(bests), best_v);
+		min_cost = Large_Float;
+		sint32 best = -1;
+		for (sint32 i = 0; i < 8; i++) {
+			if (mins[i] < min_cost || (mins[i] == min_cost && bests[i] >= 0 && bests[i] < best)) {
+				min_cost = mins[i];
+				best = bests[i];
+			}
+		}
+		// the tail comes after all lanes
+		for (; k < n; k++) {
+			if (min_cost > costs[k]) {
+				min_cost = costs[k];
+				best = k;
+			}
+		}
+		return best;
+	}
+
+	/**
+	* \brief ArgMinAvx2 that also keeps the second min of every lane. best - 1..best + 1 fall into three different lanes,
+	* so a lane whose min is in the peak gives its second min and every other lane its min.
+	*/
+	ADCENSUS_TARGET_AVX2
+	sint32 ArgMinSecondAvx2(const float32* costs, const sint32& n, float32& min_cost, float32& second_cost)
+	{
+		__m256 min_v = _mm256_set1_ps(Large_Float);
+		__m256 second_v = _mm256_set1_ps(Large_Float);
+		__m256i best_v = _mm256_set1_epi32(-1);
+		__m256i index_v = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+		const __m256i step = _mm256_set1_epi32(8);
+		sint32 k = 0;
+		for (; k + 8 <= n; k += 8) {
+			const __m256 c = _mm256_loadu_ps(costs + k);
+			const __m256 lt = _mm256_cmp_ps(c, min_v, _CMP_LT_OQ);
+			second_v = _mm256_blendv_ps(_mm256_min_ps(second_v, c), min_v, lt);
+			min_v = _mm256_blendv_ps(min_v, c, lt);
+			best_v = _mm256_blendv_epi8(best_v, index_v, _mm256_castps_si256(lt));
+			index_v = _mm256_add_epi32(index_v, step);
+		}
+
+		float32 mins[8], seconds[8];
+		sint32 bests[8];
+		_mm256_storeu_ps(mins, min_v);
+		_mm256_storeu_ps(seconds, second_v);
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(bests), best_v);
+		// the tail goes to the lane of its index
+		for (; k < n; k++) {
+			const sint32 i = k & 7;
+			if (mins[i] > costs[k]) {
+				seconds[i] = mins[i];
+				mins[i] = costs[k];
+				bests[i] = k;
+			}
+			else {
+				seconds[i] = std::min(seconds[i], costs[k]);
+			}
+		}
+
+		// the smallest index among the lanes that hold the min is the first min
+		min_cost = Large_Float;
+		sint32 best = -1;
+		for (sint32 i = 0; i < 8; i++) {
+			if (mins[i] < min_cost || (mins[i] == min_cost && bests[i] >= 0 && bests[i] < best)) {
+				min_cost = mins[i];
+				best = bests[i];
+			}
+		}
+		second_cost = Large_Float;
+		for (sint32 i = 0; i < 8; i++) {
+			const bool in_peak = bests[i] >= 0 && bests[i] >= best - 1 && bests[i] <= best + 1;
+			second_cost = std::min(second_cost, in_peak ? seconds[i] : mins[i]);
+		}
+		return best;
+	}
+
+	/** \brief 8 costs per iteration, reversed so that they match 8 contiguous right pixels */
+	ADCENSUS_TARGET_AVX2
+	void RightMinAvx2(const float32* costs, const sint32& n, const sint32& d_begin, float32* right_min, sint32* right_best)
+	{
+		const __m256i reverse = _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+		__m256i disparity_v = _mm256_add_epi32(_mm256_set1_epi32(d_begin), reverse);
+		const __m256i step = _mm256_set1_epi32(8);
+		sint32 k = 0;
+		for (; k + 8 <= n; k += 8) {
+			// lane i is costs[k + 7 - i] of right pixel i - k - 7
+			const __m256 c = _mm256_permutevar8x32_ps(_mm256_loadu_ps(costs + k), reverse);
+			float32* min_ptr = right_min - k - 7;
+			sint32* best_ptr = right_best - k - 7;
+			const __m256 m = _mm256_loadu_ps(min_ptr);
+			const __m256 lt = _mm256_cmp_ps(c, m, _CMP_LT_OQ);
+			_mm256_storeu_ps(min_ptr, _mm256_blendv_ps(m, c, lt));
+			const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(best_ptr));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(best_ptr), _mm256_blendv_epi8(b, disparity_v, _mm256_castps_si256(lt)));
+			disparity_v = _mm256_add_epi32(disparity_v, step);
+		}
+		RightMinScalar(costs + k, n - k, d_begin + k, right_min - k, right_best - k);
+	}
+#endif
+
+	/**
+	* \brief 3x3 medians of one image row, out[x] is the median of the columns x - 1, x, x + 1 of the rows r0, r1, r2, x in [0, n)
+	* The columns are sorted first, the median of the 9 values is then the median of the max of the column mins,
+	* the median of the column medians and the min of the column maxs. Invalid_Float sorts as the largest value.
+	*/
+	typedef void(*Median3x3RowFunc)(const float32* r0, const float32* r1, const float32* r2, float32* out, const sint32& n);
+
+	/** \brief median of 3 */
+	inline float32 Median3(const float32& a, const float32& b, const float32& c)
+	{
+		return std::max(std::min(a, b), std::min(std::max(a, b), c));
+	}
+
+	void Median3x3RowScalar(const float32* r0, const float32* r1, const float32* r2, float32* out, const sint32& n)
+	{
+		// the sorted column x - 1 and x, the column x + 1 is sorted in the loop
+		float32 lo[3], mid[3], hi[3];
+		for (sint32 c = 0; c < 2; c++) {
+			lo[c + 1] = std::min(std::min(r0[c - 1], r1[c - 1]), r2[c - 1]);
+			mid[c + 1] = Median3(r0[c - 1], r1[c - 1], r2[c - 1]);
+			hi[c + 1] = std::max(std::max(r0[c - 1], r1[c - 1]), r2[c - 1]);
+		}
+		for (sint32 x = 0; x < n; x++) {
+			lo[0] = lo[1]; lo[1] = lo[2];
+			mid[0] = mid[1]; mid[1] = mid[2];
+			hi[0] = hi[1]; hi[1] = hi[2];
+			lo[2] = std::min(std::min(r0[x + 1], r1[x + 1]), r2[x + 1]);
+			mid[2] = Median3(r0[x + 1], r1[x + 1], r2[x + 1]);
+			hi[2] = std::max(std::max(r0[x + 1], r1[x + 1]), r2[x + 1]);
+			out[x] = Median3(std::max(std::max(lo[0], lo[1]), lo[2]), Median3(mid[0], mid[1], mid[2]), std::min(std::min(hi[0], hi[1]), hi[2]));
+		}
+	}
+
+#if defined(ADCENSUS_X86)
+	ADCENSUS_TARGET_AVX2
+	inline __m256 Median3Avx2(const __m256& a, const __m256& b, const __m256& c)
+	{
+		return _mm256_max_ps(_mm256_min_ps(a, b), _mm256_min_ps(_mm256_max_ps(a, b), c));
+	}
+
+	/** \brief 8 pixels per iteration, the three columns of a lane are loaded from shifted addresses */
+	ADCENSUS_TARGET_AVX2
+	void Median3x3RowAvx2(const float32* r0, const float32* r1, const float32* r2, float32* out, const sint32& n)
+	{
+		sint32 x = 0;
+		for (; x + 8 <= n; x += 8) {
+			__m256 lo[3], mid[3], hi[3];
+			for (sint32 c = 0; c < 3; c++) {
+				const __m256 a = _mm256_loadu_ps(r0 + x + c - 1);
+				const __m256 b = _mm256_loadu_ps(r1 + x + c - 1);
+				const __m256 d = _mm256_loadu_ps(r2 + x + c - 1);
+				lo[c] = _mm256_min_ps(_mm256_min_ps(a, b), d);
+				mid[c] = Median3Avx2(a, b, d);
+				hi[c] = _mm256_max_ps(_mm256_max_ps(a, b), d);
+			}
+			const __m256 max_lo = _mm256_max_ps(_mm256_max_ps(lo[0], lo[1]), lo[2]);
+			const __m256 min_hi = _mm256_min_ps(_mm256_min_ps(hi[0], hi[1]), hi[2]);
+			_mm256_storeu_ps(out + x, Median3Avx2(max_lo, Median3Avx2(mid[0], mid[1], mid[2]), min_hi));
+		}
+		Median3x3RowScalar(r0 + x, r1 + x, r2 + x, out + x, n - x);
+	}
+#endif
+
+	/** \brief median of the window of (x,y) clipped to the image, the upper median if the clipped window has an even size */
+	float32 MedianAt(const float32* in, const sint32& width, const sint32& height, const sint32& x, const sint32& y, const sint32& radius,
+		vector<float32>& wnd_data)
+	{
+		wnd_data.clear();
+		for (sint32 r = -radius; r <= radius; r++) {
+			for (sint32 c = -radius; c <= radius; c++) {
+				const sint32 row = y + r;
+				const sint32 col = x + c;
+				if (row >= 0 && row < height && col >= 0 && col < width) {
+					wnd_data.push_back(in[row * width + col]);
+				}
+			}
+		}
+		std::nth_element(wnd_data.begin(), wnd_data.begin() + wnd_data.size() / 2, wnd_data.end());
+		return wnd_data[wnd_data.size() / 2];
+	}
+
+	/** \brief bins per pixel of disparity of the histogram median */
+	const sint32 Median_Fixed_Scale = 16;
+	/** \brief max bins of the histogram median, wider value ranges are filtered with MedianAt */
+	const sint32 Median_Max_Bins = 65535;
+	static_assert(Median_Max_Bins <= std::numeric_limits<uint16>::max(), "the invalid bin Median_Max_Bins must fit in uint16");
+
+	/**
+	* \brief median filter with a running histogram per row (Huang), the values are rounded to 1 / Median_Fixed_Scale above v_min
+	* Bin num_bins holds Invalid_Float. The median bin is moved along with the window, the count below it is kept up to date.
+	*/
+	void MedianFilterHistogram(const float32* in, float32* out, const sint32& width, const sint32& height, const sint32& radius,
+		const float32& v_min, const sint32& num_bins)
+	{
+		const sint32 img_size = width * height;
+		vector<uint16> bins(img_size);
+		for (sint32 i = 0; i < img_size; i++) {
+			if (in[i] == Invalid_Float) {
+				bins[i] = static_cast<uint16>(num_bins);
+			}
+			else {
+				const sint32 b = lround((in[i] - v_min) * Median_Fixed_Scale);
+				bins[i] = static_cast<uint16>(std::min(std::max(b, 0), num_bins - 1));
+			}
+		}
+
+		vector<sint32> histogram(num_bins + 1);
+		for (sint32 y = 0; y < height; y++) {
+			const sint32 row_begin = std::max(y - radius, 0);
+			const sint32 row_end = std::min(y + radius + 1, height);
+			std::fill(histogram.begin(), histogram.end(), 0);
+			sint32 count = 0, median = 0, below = 0;
+			const auto update = [&](const sint32& col, const sint32& step) {
+				for (sint32 row = row_begin; row < row_end; row++) {
+					const uint16& b = bins[row * width + col];
+					histogram[b] += step;
+					if (b < median) {
+						below += step;
 					}
 				}
+				count += step * (row_end - row_begin);
+			};
+			for (sint32 col = 0; col < std::min(radius, width); col++) {
+				update(col, 1);
 			}
+			for (sint32 x = 0; x < width; x++) {
+				if (x + radius < width) {
+					update(x + radius, 1);
+				}
+				if (x - radius - 1 >= 0) {
+					update(x - radius - 1, -1);
+				}
+				// the median is value count / 2 of the sorted window
+				const sint32 rank = count / 2;
+				while (below > rank) {
+					below -= histogram[--median];
+				}
+				while (below + histogram[median] <= rank) {
+					below += histogram[median++];
+				}
+				out[y * width + x] = median == num_bins ? Invalid_Float : v_min + static_cast<float32>(median) / Median_Fixed_Scale;
+			}
+		}
+	}
+}
+
+void adcensus_util::census_transform_9x7(const uint8* source, vector<uint64>& census, const sint32& width, const sint32& height)
+{
+	if (source == nullptr || census.empty() || width <= 9 || height <= 7) {
+		return;
+	}
+
+#if defined(ADCENSUS_X86)
+	const auto& cpu = adcensus_simd::GetCpuFeatures();
+#endif
 
+	// ؼcensusֵ
+	for (sint32 i = 4; i < height - 4; i++) {
+		sint32 j = 3;
+#if defined(ADCENSUS_X86)
+		if (cpu.avx512bw) {
+			j = census_row_9x7_avx512(source, &census[0], width, i);
+		}
+		else if (cpu.avx2) {
+			j = census_row_9x7_avx2(source, &census[0], width, i);
+		}
+#endif
+		for (; j < width - 3; j++) {
 			// صcensusֵ
-			census[i * width + j] = census_val;
+			census[i * width + j] = census_9x7_pixel(source, width, i, j);
 		}
 	}
 }
@@ -41,6 +535,9 @@ void adcensus_util::census_transform_9x7(const uint8* source, vector<uint64>& ce
 
 uint8 adcensus_util::Hamming64(const uint64& x, const uint64& y)
 {
+#if defined(__GNUC__) || defined(__clang__)
+	return static_cast<uint8>(__builtin_popcountll(x ^ y));
+#else
 	uint64 dist = 0, val = x ^ y;
 
 	// Count the number of set bits
@@ -50,32 +547,173 @@ uint8 adcensus_util::Hamming64(const uint64& x, const uint64& y)
 	}
 
 	return static_cast<uint8>(dist);
+#endif
 }
 
 void adcensus_util::MedianFilter(const float32* in, float32* out, const sint32& width, const sint32& height, const sint32 wnd_size)
 {
 	const sint32 radius = wnd_size / 2;
-	const sint32 size = wnd_size * wnd_size;
-	
-	std::vector<float32> wnd_data;
-	wnd_data.reserve(size);
+	const sint32 img_size = width * height;
+	if (img_size <= 0 || radius <= 0) {
+		if (out != in && img_size > 0) {
+			memcpy(out, in, img_size * sizeof(float32));
+		}
+		return;
+	}
+
+	// the medians are taken from the input, filtering in place works on a copy
+	vector<float32> in_copy;
+	if (in == out) {
+		in_copy.assign(in, in + img_size);
+		in = in_copy.data();
+	}
+
+	vector<float32> wnd_data;
+	wnd_data.reserve(wnd_size * wnd_size);
+
+	if (radius == 1) {
+		// the sorting network on the inner pixels, the clipped windows of the border are sorted
+		Median3x3RowFunc median_row = Median3x3RowScalar;
+#if defined(ADCENSUS_X86)
+		if (adcensus_simd::GetCpuFeatures().avx2) {
+			median_row = Median3x3RowAvx2;
+		}
+#endif
+		for (sint32 y = 0; y < height; y++) {
+			if (y == 0 || y == height - 1 || width < 3) {
+				for (sint32 x = 0; x < width; x++) {
+					out[y * width + x] = MedianAt(in, width, height, x, y, radius, wnd_data);
+				}
+				continue;
+			}
+			const float32* row = in + y * width;
+			median_row(row - width + 1, row + 1, row + width + 1, out + y * width + 1, width - 2);
+			out[y * width] = MedianAt(in, width, height, 0, y, radius, wnd_data);
+			out[y * width + width - 1] = MedianAt(in, width, height, width - 1, y, radius, wnd_data);
+		}
+		return;
+	}
 
+	// larger windows use the histogram of the fixed point values if their range is small enough
+	float32 v_min = Invalid_Float, v_max = -Invalid_Float;
+	for (sint32 i = 0; i < img_size; i++) {
+		if (in[i] != Invalid_Float) {
+			v_min = std::min(v_min, in[i]);
+			v_max = std::max(v_max, in[i]);
+		}
+	}
+	if (v_min == Invalid_Float) {
+		std::fill(out, out + img_size, Invalid_Float);
+		return;
+	}
+	// num_bins values and the invalid bin num_bins, which has to fit in uint16
+	const float32 range = ceil((v_max - v_min) * Median_Fixed_Scale);
+	if (range + 1 <= Median_Max_Bins) {
+		MedianFilterHistogram(in, out, width, height, radius, v_min, static_cast<sint32>(range) + 1);
+		return;
+	}
 	for (sint32 y = 0; y < height; y++) {
 		for (sint32 x = 0; x < width; x++) {
-			wnd_data.clear();
-			for (sint32 r = -radius; r <= radius; r++) {
-				for (sint32 c = -radius; c <= radius; c++) {
-					const sint32 row = y + r;
-					const sint32 col = x + c;
-					if (row >= 0 && row < height && col >= 0 && col < width) {
-						wnd_data.push_back(in[row * width + col]);
+			out[y * width + x] = MedianAt(in, width, height, x, y, radius, wnd_data);
+		}
+	}
+}
+
+void adcensus_util::ComputeDisparityRow(const float32* costs, const sint32& width, const sint32& min_disparity, const sint32& max_disparity,
+	const sint32& x_begin, const sint32& x_end, float32* disp_left, float32* disp_right, float32* right_min, sint32* right_best,
+	float32* confidence, const ConfidenceMeasure& measure)
+{
+	const sint32 disp_range = max_disparity - min_disparity;
+
+	ArgMinFunc arg_min = ArgMinScalar;
+	ArgMinSecondFunc arg_min_second = ArgMinSecondScalar;
+	RightMinFunc right_min_update = RightMinScalar;
+#if defined(ADCENSUS_X86)
+	if (adcensus_simd::GetCpuFeatures().avx2) {
+		arg_min = ArgMinAvx2;
+		arg_min_second = ArgMinSecondAvx2;
+		right_min_update = RightMinAvx2;
+	}
+#endif
+
+	const bool peak_ratio = confidence != nullptr && measure == ConfidencePeakRatio;
+
+	// the min of the costs and its neighbours to the sub-pixel disparity
+	const auto sub_pixel = [](const sint32& best_disparity, const float32& min_cost, const float32& cost_1, const float32& cost_2) {
+		const float32 denom = cost_1 + cost_2 - 2 * min_cost;
+		if (denom != 0.0f) {
+			return static_cast<float32>(best_disparity) + (cost_1 - cost_2) / (denom * 2.0f);
+		}
+		return static_cast<float32>(best_disparity);
+	};
+
+	// the right pixels of [x_begin, x_end) see the left pixels up to max_disparity - 1 to their right
+	sint32 sweep_begin = x_begin, sweep_end = x_end;
+	if (disp_right != nullptr) {
+		std::fill(right_min + x_begin, right_min + x_end, Large_Float);
+		std::fill(right_best + x_begin, right_best + x_end, 0);
+		sweep_begin = std::max(std::min(x_begin, x_begin + min_disparity), 0);
+		sweep_end = std::min(std::max(x_end, x_end + max_disparity - 1), width);
+	}
+
+	for (sint32 x = sweep_begin; x < sweep_end; x++) {
+		const float32* cost_local = costs + x * disp_range;
+
+		if (x >= x_begin && x < x_end) {
+			// the peak ratio takes the second min from the same sweep
+			float32 min_cost, second_cost = Large_Float;
+			const sint32 best = peak_ratio ? arg_min_second(cost_local, disp_range, min_cost, second_cost) :
+				arg_min(cost_local, disp_range, min_cost);
+			const sint32 best_disparity = best >= 0 ? best + min_disparity : 0;
+			// the min at either end of the range is not a match
+			if (best_disparity == min_disparity || best_disparity == max_disparity - 1) {
+				disp_left[x] = Invalid_Float;
+				if (confidence != nullptr) {
+					confidence[x] = 0.0f;
+				}
+			}
+			else {
+				const float32 cost_1 = cost_local[best - 1];
+				const float32 cost_2 = cost_local[best + 1];
+				disp_left[x] = sub_pixel(best_disparity, min_cost, cost_1, cost_2);
+				if (confidence != nullptr) {
+					if (measure == ConfidenceCurvature) {
+						confidence[x] = cost_1 + cost_2 - 2 * min_cost;
+					}
+					else {
+						confidence[x] = second_cost > 0.0f ? 1.0f - min_cost / second_cost : 0.0f;
 					}
 				}
 			}
-			std::sort(wnd_data.begin(), wnd_data.end());
-			if (!wnd_data.empty()) {
-				out[y * width + x] = wnd_data[wnd_data.size() / 2];
+		}
+
+		// cost of left pixel x at d is the cost of right pixel x - d, the disparities of a right pixel pass in increasing order
+		if (disp_right != nullptr) {
+			const sint32 d_begin = std::max(min_disparity, x - x_end + 1);
+			const sint32 d_end = std::min(max_disparity, x - x_begin + 1);
+			if (d_end > d_begin) {
+				right_min_update(cost_local + d_begin - min_disparity, d_end - d_begin, d_begin, right_min + x - d_begin, right_best + x - d_begin);
 			}
 		}
 	}
-}
\ No newline at end of file
+
+	if (disp_right == nullptr) {
+		return;
+	}
+	for (sint32 x = x_begin; x < x_end; x++) {
+		const sint32 best_disparity = right_best[x];
+		if (best_disparity == min_disparity || best_disparity == max_disparity - 1) {
+			disp_right[x] = static_cast<float32>(best_disparity);
+			continue;
+		}
+		// cost of right pixel x at d, Large_Float if left pixel x + d is outside of the row
+		const auto cost_at = [&](const sint32& d) -> float32 {
+			const sint32 col_left = x + d;
+			if (col_left < 0 || col_left >= width || d < min_disparity || d >= max_disparity) {
+				return Large_Float;
+			}
+			return costs[col_left * disp_range + d - min_disparity];
+		};
+		disp_right[x] = sub_pixel(best_disparity, right_min[x], cost_at(best_disparity - 1), cost_at(best_disparity + 1));
+	}
+}
@@ -29,6 +29,32 @@ namespace adcensus_util
 	* \param width			룬
 	* \param height			룬߶
 	* \param wnd_size		룬ڿ
+	* The window is clipped at the borders, an even number of values gives the upper median. Invalid_Float sorts as
+	* the largest value. in and out may be the same buffer, the medians are always taken from the unfiltered input.
+	* 3x3 windows use a sorting network and are exact. Larger windows use a running histogram of the values rounded
+	* to 1/16 pixel, the result is rounded the same way.
 	*/
 	void MedianFilter(const float32* in, float32* out, const sint32& width, const sint32& height, const sint32 wnd_size);
+
+	/**
+	* \brief winner-take-all disparities of both views on one image row with sub-pixel parabola fitting, in one sweep
+	* over the costs in storage order. Right pixel xr at disparity d has the cost of left pixel xr + d, its running
+	* min is kept in right_min/right_best while the left pixels pass by.
+	* \param costs			input, costs of the row, pixel x at disparity d is costs[x * disp_range + d - min_disparity]
+	* \param width			input, row width
+	* \param min_disparity	input, min disparity
+	* \param max_disparity	input, max disparity
+	* \param x_begin		input, first pixel of both views
+	* \param x_end			input, one past the last pixel of both views
+	* \param disp_left		output, left disparities of the row, invalid if the min is at either end of the range
+	* \param disp_right	output, right disparities of the row, a min at either end of the range keeps the integer disparity,
+	*						nullptr: no right view
+	* \param right_min		buffer, width elements, min cost of the right pixels
+	* \param right_best	buffer, width elements, disparity of the min cost of the right pixels
+	* \param confidence	output, confidence of the left disparities of the row, nullptr: no confidence
+	* \param measure		input, confidence measure
+	*/
+	void ComputeDisparityRow(const float32* costs, const sint32& width, const sint32& min_disparity, const sint32& max_disparity,
+		const sint32& x_begin, const sint32& x_end, float32* disp_left, float32* disp_right, float32* right_min, sint32* right_best,
+		float32* confidence = nullptr, const ConfidenceMeasure& measure = ConfidencePeakRatio);
 }
\ No newline at end of file
@@ -6,10 +6,134 @@
 
 #include "cost_computor.h"
 #include "adcensus_util.h"
+#include "adcensus_simd.h"
+#include <algorithm>
 #include <cmath>
 
+namespace
+{
+	/** \brief right image data of a disparity run, pixel k of the run is x-(d_lo+k) */
+	struct RightRun {
+		const uint8* b;
+		const uint8* g;
+		const uint8* r;
+		const uint64* census;
+	};
+
+	/** \brief integer AD-Census terms of a disparity run of length n */
+	typedef void(*CostRunFunc)(const uint8* bgr_l, const uint64& census_l, const RightRun& right, const sint32& n, uint16* ad, uint16* ham);
+
+	void CostRunScalar(const uint8* bgr_l, const uint64& census_l, const RightRun& right, const sint32& n, uint16* ad, uint16* ham)
+	{
+		for (sint32 k = 0; k < n; k++) {
+			ad[k] = static_cast<uint16>(abs(bgr_l[0] - right.b[k]) + abs(bgr_l[1] - right.g[k]) + abs(bgr_l[2] - right.r[k]));
+			ham[k] = adcensus_util::Hamming64(census_l, right.census[k]);
+		}
+	}
+
+#if defined(ADCENSUS_X86)
+	ADCENSUS_TARGET_POPCNT
+	void CostRunPopcnt(const uint8* bgr_l, const uint64& census_l, const RightRun& right, const sint32& n, uint16* ad, uint16* ham)
+	{
+		for (sint32 k = 0; k < n; k++) {
+			ad[k] = static_cast<uint16>(abs(bgr_l[0] - right.b[k]) + abs(bgr_l[1] - right.g[k]) + abs(bgr_l[2] - right.r[k]));
+			ham[k] = static_cast<uint16>(adcensus_simd::Popcnt64(census_l ^ right.census[k]));
+		}
+	}
+
+	/** \brief popcount of each 64-bit lane with the nibble lookup table (AVX2 has no vector popcount) */
+	ADCENSUS_TARGET_AVX2
+	inline __m256i Popcount64Avx2(const __m256i& v)
+	{
+		const __m256i lut = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+											 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+		const __m256i low_mask = _mm256_set1_epi8(0x0f);
+		const __m256i lo = _mm256_and_si256(v, low_mask);
+		const __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), low_mask);
+		const __m256i cnt = _mm256_add_epi8(_mm256_shuffle_epi8(lut, lo), _mm256_shuffle_epi8(lut, hi));
+		return _mm256_sad_epu8(cnt, _mm256_setzero_si256());
+	}
+
+	/** \brief 8 disparities per iteration */
+	ADCENSUS_TARGET_AVX2
+	void CostRunAvx2(const uint8* bgr_l, const uint64& census_l, const RightRun& right, const sint32& n, uint16* ad, uint16* ham)
+	{
+		const __m128i bl = _mm_set1_epi16(bgr_l[0]);
+		const __m128i gl = _mm_set1_epi16(bgr_l[1]);
+		const __m128i rl = _mm_set1_epi16(bgr_l[2]);
+		const __m256i cl = _mm256_set1_epi64x(static_cast<long long>(census_l));
+		// counts of the two popcount vectors are interleaved as c0,c4,c1,c5,... after merging
+		const __m256i order = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+		sint32 k = 0;
+		for (; k + 8 <= n; k += 8) {
+			const __m128i b = _mm_cvtepu8_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(right.b + k)));
+			const __m128i g = _mm_cvtepu8_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(right.g + k)));
+			const __m128i r = _mm_cvtepu8_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(right.r + k)));
+			const __m128i sum = _mm_add_epi16(_mm_add_epi16(_mm_abs_epi16(_mm_sub_epi16(b, bl)), _mm_abs_epi16(_mm_sub_epi16(g, gl))),
+											  _mm_abs_epi16(_mm_sub_epi16(r, rl)));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(ad + k), sum);
+
+			const __m256i c0 = Popcount64Avx2(_mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(right.census + k)), cl));
+			const __m256i c1 = Popcount64Avx2(_mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(right.census + k + 4)), cl));
+			const __m256i c = _mm256_permutevar8x32_epi32(_mm256_or_si256(c0, _mm256_slli_epi64(c1, 32)), order);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(ham + k), _mm_packus_epi32(_mm256_castsi256_si128(c), _mm256_extracti128_si256(c, 1)));
+		}
+		for (; k < n; k++) {
+			ad[k] = static_cast<uint16>(abs(bgr_l[0] - right.b[k]) + abs(bgr_l[1] - right.g[k]) + abs(bgr_l[2] - right.r[k]));
+			ham[k] = static_cast<uint16>(adcensus_simd::Popcnt64(census_l ^ right.census[k]));
+		}
+	}
+
+	/** \brief 16 disparities per iteration with the native 64-bit vector popcount */
+	ADCENSUS_TARGET_AVX512_VPOPCNT
+	void CostRunAvx512(const uint8* bgr_l, const uint64& census_l, const RightRun& right, const sint32& n, uint16* ad, uint16* ham)
+	{
+		const __m256i bl = _mm256_set1_epi16(bgr_l[0]);
+		const __m256i gl = _mm256_set1_epi16(bgr_l[1]);
+		const __m256i rl = _mm256_set1_epi16(bgr_l[2]);
+		const __m512i cl = _mm512_set1_epi64(static_cast<long long>(census_l));
+		sint32 k = 0;
+		for (; k + 16 <= n; k += 16) {
+			const __m256i b = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(right.b + k)));
+			const __m256i g = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(right.g + k)));
+			const __m256i r = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(right.r + k)));
+			const __m256i sum = _mm256_add_epi16(_mm256_add_epi16(_mm256_abs_epi16(_mm256_sub_epi16(b, bl)), _mm256_abs_epi16(_mm256_sub_epi16(g, gl))),
+												 _mm256_abs_epi16(_mm256_sub_epi16(r, rl)));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(ad + k), sum);
+
+			const __m512i c0 = _mm512_popcnt_epi64(_mm512_xor_si512(_mm512_loadu_si512(right.census + k), cl));
+			const __m512i c1 = _mm512_popcnt_epi64(_mm512_xor_si512(_mm512_loadu_si512(right.census + k + 8), cl));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(ham + k), _mm512_cvtepi64_epi16(c0));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(ham + k + 8), _mm512_cvtepi64_epi16(c1));
+		}
+		for (; k < n; k++) {
+			ad[k] = static_cast<uint16>(abs(bgr_l[0] - right.b[k]) + abs(bgr_l[1] - right.g[k]) + abs(bgr_l[2] - right.r[k]));
+			ham[k] = static_cast<uint16>(adcensus_simd::Popcnt64(census_l ^ right.census[k]));
+		}
+	}
+#endif
+
+	/** \brief the best kernel the cpu supports */
+	CostRunFunc SelectCostRunFunc()
+	{
+#if defined(ADCENSUS_X86)
+		const auto& cpu = adcensus_simd::GetCpuFeatures();
+		if (cpu.avx512vpopcntdq) {
+			return CostRunAvx512;
+		}
+		if (cpu.avx2) {
+			return CostRunAvx2;
+		}
+		if (cpu.popcnt) {
+			return CostRunPopcnt;
+		}
+#endif
+		return CostRunScalar;
+	}
+}
+
 CostComputor::CostComputor(): width_(0), height_(0), img_left_(nullptr), img_right_(nullptr),
-                              lambda_ad_(0), lambda_census_(0), min_disparity_(0), max_disparity_(0),
+                              thread_pool_(nullptr), arena_(nullptr), lambda_ad_(0), lambda_census_(0), min_disparity_(0), max_disparity_(0),
                               is_initialized_(false) { }
 
 CostComputor::~CostComputor()
@@ -17,7 +141,8 @@ CostComputor::~CostComputor()
 	
 }
 
-bool CostComputor::Initialize(const sint32& width, const sint32& height, const sint32& min_disparity, const sint32& max_disparity)
+bool CostComputor::Initialize(const sint32& width, const sint32& height, const sint32& min_disparity, const sint32& max_disparity,
+	const CostType& cost_type, const CostLayout& cost_layout)
 {
 	width_ = width;
 	height_ = height;
@@ -38,9 +163,11 @@ bool CostComputor::Initialize(const sint32& width, const sint32& height, const s
 	census_left_.resize(img_size,0);
 	census_right_.resize(img_size,0);
 	// ��ʼ��������
-	cost_init_.resize(img_size * disp_range);
+	cost_init_.Initialize(width_, height_, disp_range, cost_type, cost_layout, arena_);
+	// per thread row scratch
+	InitRowBuffers(thread_pool_ != nullptr ? thread_pool_->num_threads() : 1);
 
-	is_initialized_ = !gray_left_.empty() && !gray_right_.empty() && !census_left_.empty() && !census_right_.empty() && !cost_init_.empty();
+	is_initialized_ = !gray_left_.empty() && !gray_right_.empty() && !census_left_.empty() && !census_right_.empty() && cost_init_.size() > 0;
 	return is_initialized_;
 }
 
@@ -52,25 +179,79 @@ void CostComputor::SetData(const uint8* img_left, const uint8* img_right)
 
 void CostComputor::SetParams(const sint32& lambda_ad, const sint32& lambda_census)
 {
+	if (lambda_ad == lambda_ad_ && lambda_census == lambda_census_ && !trans_ad_.empty()) {
+		return;
+	}
 	lambda_ad_ = lambda_ad;
 	lambda_census_ = lambda_census;
+	BuildTransferTables();
+}
+
+void CostComputor::SetThreadPool(ThreadPool* thread_pool)
+{
+	thread_pool_ = thread_pool;
+}
+
+void CostComputor::SetArena(MemoryArena* arena)
+{
+	arena_ = arena;
+}
+
+void CostComputor::InitRowBuffers(const sint32& num_threads)
+{
+	const sint32 disp_range = max_disparity_ - min_disparity_;
+	row_buffers_.resize(num_threads);
+	for (auto& buffer : row_buffers_) {
+		buffer.rev_b.resize(width_);
+		buffer.rev_g.resize(width_);
+		buffer.rev_r.resize(width_);
+		buffer.rev_census.resize(width_);
+		buffer.run_ad.resize(disp_range);
+		buffer.run_census.resize(disp_range);
+		// the disparity-major volume is written one image row at a time through a pixel-major row
+		if (cost_init_.layout() == CostDisparityMajor) {
+			buffer.cost_row.Initialize(width_, 1, disp_range, cost_init_.type());
+		}
+		else {
+			buffer.cost_row.Release();
+		}
+	}
+}
+
+void CostComputor::BuildTransferTables()
+{
+	const auto lambda_ad = lambda_ad_;
+	const auto lambda_census = lambda_census_;
+
+	trans_ad_.resize(3 * 255 + 1);
+	for (sint32 ad = 0; ad < static_cast<sint32>(trans_ad_.size()); ad++) {
+		const float32 cost_ad = ad / 3.0f;
+		trans_ad_[ad] = 1 - exp(-cost_ad / lambda_ad) + 1;
+	}
+	trans_census_.resize(64 + 1);
+	for (sint32 hamming = 0; hamming < static_cast<sint32>(trans_census_.size()); hamming++) {
+		const float32 cost_census = static_cast<float32>(hamming);
+		trans_census_[hamming] = exp(-cost_census / lambda_census);
+	}
 }
 
 void CostComputor::ComputeGray()
 {
 	// ��ɫת�Ҷ�
-	for (sint32 n = 0; n < 2; n++) {
-		const auto color = (n == 0) ? img_left_ : img_right_;
-		auto& gray = (n == 0) ? gray_left_ : gray_right_;
-		for (sint32 y = 0; y < height_; y++) {
-			for (sint32 x = 0; x < width_; x++) {
-				const auto b = color[y * width_ * 3 + 3 * x];
-				const auto g = color[y * width_ * 3 + 3 * x + 1];
-				const auto r = color[y * width_ * 3 + 3 * x + 2];
-				gray[y * width_ + x] = uint8(r * 0.299 + g * 0.587 + b * 0.114);
+	ThreadPool::ParallelFor(thread_pool_, 0, height_, [&](const sint32& y_begin, const sint32& y_end, const sint32&) {
+		for (sint32 n = 0; n < 2; n++) {
+			const auto color = (n == 0) ? img_left_ : img_right_;
+			auto& gray = (n == 0) ? gray_left_ : gray_right_;
+			for (sint32 y = y_begin; y < y_end; y++) {
+				for (sint32 x = 0; x < width_; x++) {
+					const auto b = color[y * width_ * 3 + 3 * x];
+					const auto g = color[y * width_ * 3 + 3 * x + 1];
+					const auto r = color[y * width_ * 3 + 3 * x + 2];
+					gray[y * width_ + x] = uint8(r * 0.299 + g * 0.587 + b * 0.114);
+				}
 			}
 		}
-	}
+	});
 }
 
 void CostComputor::CensusTransform()
@@ -81,44 +262,98 @@ void CostComputor::CensusTransform()
 }
 
 void CostComputor::ComputeCost()
+{
+	switch (cost_init_.type()) {
+	case CostUInt16:
+		ComputeCost(cost_init_.ptr<uint16>());
+		break;
+	case CostUInt8:
+		ComputeCost(cost_init_.ptr<uint8>());
+		break;
+	default:
+		ComputeCost(cost_init_.ptr<float32>());
+		break;
+	}
+}
+
+template<typename T>
+void CostComputor::ComputeCost(T* cost_init)
 {
 	const sint32 disp_range = max_disparity_ - min_disparity_;
 
-	// Ԥ�����
-	const auto lambda_ad = lambda_ad_;
-	const auto lambda_census = lambda_census_;
+	// cost transfer tables
+	if (trans_ad_.empty()) {
+		BuildTransferTables();
+	}
+	const auto trans_ad = &trans_ad_[0];
+	const auto trans_census = &trans_census_[0];
+
+	// cost of the disparities that fall outside of the right image
+	const T cost_out = CostTraits<T>::Store(1.0f);
+
+	const CostRunFunc run_kernel = SelectCostRunFunc();
+
+	const bool disparity_major = cost_init_.layout() == CostDisparityMajor;
+	const size_t slice_size = static_cast<size_t>(width_) * height_;
+
+	const sint32 num_threads = thread_pool_ != nullptr ? thread_pool_->num_threads() : 1;
+	if (static_cast<sint32>(row_buffers_.size()) != num_threads) {
+		InitRowBuffers(num_threads);
+	}
 
 	// �������
-	for (sint32 y = 0; y < height_; y++) {
-		for (sint32 x = 0; x < width_; x++) {
-			const auto bl = img_left_[y * width_ * 3 + 3 * x];
-			const auto gl = img_left_[y * width_ * 3 + 3 * x + 1];
-			const auto rl = img_left_[y * width_ * 3 + 3 * x + 2];
-			const auto& census_val_l = census_left_[y * width_ + x];
-			// ���Ӳ�������ֵ
-			for (sint32 d = min_disparity_; d < max_disparity_; d++) {
-				auto& cost = cost_init_[y * width_ * disp_range + x * disp_range + (d - min_disparity_)];
-				const sint32 xr = x - d;
-				if (xr < 0 || xr >= width_) {
-					cost = 1.0f;
+	// rows are independent, every thread computes a contiguous block of rows with its own scratch
+	ThreadPool::ParallelFor(thread_pool_, 0, height_, [&](const sint32& y_begin, const sint32& y_end, const sint32& thread_id) {
+		auto& buffer = row_buffers_[thread_id];
+		const RightRun rev_row = { &buffer.rev_b[0], &buffer.rev_g[0], &buffer.rev_r[0], &buffer.rev_census[0] };
+		uint16* run_ad = &buffer.run_ad[0];
+		uint16* run_census = &buffer.run_census[0];
+		T* cost_row = disparity_major ? buffer.cost_row.ptr<T>() : nullptr;
+
+		for (sint32 y = y_begin; y < y_end; y++) {
+			// right row reversed: pixel xr is stored at width-1-xr, so x-d for increasing d is contiguous
+			const auto img_row_r = img_right_ + y * width_ * 3;
+			const auto census_row_r = &census_right_[y * width_];
+			for (sint32 xr = 0; xr < width_; xr++) {
+				const sint32 k = width_ - 1 - xr;
+				buffer.rev_b[k] = img_row_r[3 * xr];
+				buffer.rev_g[k] = img_row_r[3 * xr + 1];
+				buffer.rev_r[k] = img_row_r[3 * xr + 2];
+				buffer.rev_census[k] = census_row_r[xr];
+			}
+
+			for (sint32 x = 0; x < width_; x++) {
+				const auto img_l = img_left_ + y * width_ * 3 + 3 * x;
+				const auto& census_val_l = census_left_[y * width_ + x];
+				const auto cost = disparity_major ? cost_row + x * disp_range : cost_init + y * width_ * disp_range + x * disp_range;
+
+				// disparities with xr = x - d in [0, width) form one run [d_lo, d_hi), the others are out of the image
+				const sint32 d_lo = std::max(min_disparity_, x - width_ + 1);
+				const sint32 d_hi = std::min(max_disparity_, x + 1);
+				std::fill(cost, cost + (std::min(d_lo, max_disparity_) - min_disparity_), cost_out);
+				std::fill(cost + (std::max(d_hi, min_disparity_) - min_disparity_), cost + disp_range, cost_out);
+				if (d_lo >= d_hi) {
 					continue;
 				}
 
-				// ad����
-				const auto br = img_right_[y * width_ * 3 + 3 * xr];
-				const auto gr = img_right_[y * width_ * 3 + 3 * xr + 1];
-				const auto rr = img_right_[y * width_ * 3 + 3 * xr + 2];
-				const float32 cost_ad = (abs(bl - br) + abs(gl - gr) + abs(rl - rr)) / 3.0f;
+				const sint32 n = d_hi - d_lo;
+				const sint32 base = width_ - 1 - x + d_lo;
+				const RightRun right = { rev_row.b + base, rev_row.g + base, rev_row.r + base, rev_row.census + base };
+				run_kernel(img_l, census_val_l, right, n, run_ad, run_census);
 
-				// census����
-				const auto& census_val_r = census_right_[y * width_ + xr];
-				const float32 cost_census = static_cast<float32>(adcensus_util::Hamming64(census_val_l, census_val_r));
+				const auto cost_run_ptr = cost + (d_lo - min_disparity_);
+				for (sint32 k = 0; k < n; k++) {
+					// ad-census����
+					cost_run_ptr[k] = CostTraits<T>::Store(static_cast<float32>(trans_ad[run_ad[k]] - trans_census[run_census[k]]));
+				}
+			}
 
-				// ad-census����
-				cost = 1 - exp(-cost_ad / lambda_ad) + 1 - exp(-cost_census / lambda_census);
+			// scatter the row into row y of every disparity slice
+			if (disparity_major) {
+				TransposeCosts(cost_row, width_, disp_range, disp_range, cost_init + y * width_, slice_size);
 			}
 		}
-	}
+	});
 }
 
 void CostComputor::Compute()
@@ -139,10 +374,10 @@ void CostComputor::Compute()
 
 float32* CostComputor::get_cost_ptr()
 {
-	if (!cost_init_.empty()) {
-		return &cost_init_[0];
-	}
-	else {
-		return nullptr;
-	}
+	return cost_init_.ptr<float32>();
+}
+
+CostVolume* CostComputor::get_cost_volume()
+{
+	return &cost_init_;
 }
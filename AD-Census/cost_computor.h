@@ -8,6 +8,9 @@
 #define AD_CENSUS_COST_COMPUTOR_H_
 
 #include "adcensus_types.h"
+#include "cost_volume.h"
+#include "memory_arena.h"
+#include "thread_pool.h"
 
 /**
  * \brief ۼ
@@ -23,9 +26,12 @@ public:
 	 * \param height		Ӱ
 	 * \param min_disparity	СӲ
 	 * \param max_disparity	Ӳ
+	 * \param cost_type		cost volume storage type
+	 * \param cost_layout	cost volume memory layout
 	 * \return true: ʼɹ
 	 */
-	bool Initialize(const sint32& width, const sint32& height, const sint32& min_disparity, const sint32& max_disparity);
+	bool Initialize(const sint32& width, const sint32& height, const sint32& min_disparity, const sint32& max_disparity,
+					const CostType& cost_type = CostFloat32, const CostLayout& cost_layout = CostPixelMajor);
 
 	/**
 	 * \brief ôۼ
@@ -41,12 +47,27 @@ public:
 	 */
 	void SetParams(const sint32& lambda_ad, const sint32& lambda_census);
 
+	/**
+	 * \brief set the thread pool the cost computation runs on, image rows are split between the threads
+	 * \param thread_pool	thread pool, nullptr: run on the calling thread
+	 */
+	void SetThreadPool(ThreadPool* thread_pool);
+
+	/**
+	 * \brief set the arena the cost volume is taken from, before Initialize
+	 * \param arena		memory arena, nullptr: the volume allocates its own storage
+	 */
+	void SetArena(MemoryArena* arena);
+
 	/** \brief ʼ */
 	void Compute();
 
 	/** \brief ȡʼָ */
 	float32* get_cost_ptr();
 
+	/** \brief initial cost volume */
+	CostVolume* get_cost_volume();
+
 private:
 	/** \brief Ҷ */
 	void ComputeGray();
@@ -56,6 +77,29 @@ private:
 
 	/** \brief  */
 	void ComputeCost();
+	template<typename T>
+	void ComputeCost(T* cost_init);
+
+	/** \brief build the AD and census cost transfer tables for the current lambdas */
+	void BuildTransferTables();
+
+	/** \brief allocate one RowBuffer per thread */
+	void InitRowBuffers(const sint32& num_threads);
+
+	/** \brief scratch of the rows computed by one thread */
+	struct RowBuffer {
+		/** \brief right image row reversed into b/g/r planes, the pixels x-d of consecutive d are contiguous in it */
+		vector<uint8> rev_b;
+		vector<uint8> rev_g;
+		vector<uint8> rev_r;
+		/** \brief census of the reversed right image row */
+		vector<uint64> rev_census;
+		/** \brief integer AD (sum of the 3 channels) and census hamming distance of one disparity run */
+		vector<uint16> run_ad;
+		vector<uint16> run_census;
+		/** \brief costs of one image row in pixel-major layout, used when cost_init_ is disparity-major */
+		CostVolume cost_row;
+	};
 private:
 	/** \brief ͼߴ */
 	sint32	width_;
@@ -76,13 +120,27 @@ private:
 	vector<uint64> census_right_;
 
 	/** \brief ʼƥ	*/
-	vector<float32> cost_init_;
+	CostVolume cost_init_;
+	/** \brief per thread scratch */
+	vector<RowBuffer> row_buffers_;
+	/** \brief thread pool, nullptr: single threaded */
+	ThreadPool* thread_pool_;
+	/** \brief arena of the cost volume, nullptr: own storage */
+	MemoryArena* arena_;
 
 	/** \brief lambda_ad*/
 	sint32 lambda_ad_;
 	/** \brief lambda_census*/
 	sint32 lambda_census_;
 
+	/**
+	 * \brief cost transfer tables, indexed by the AD sum of the 3 channels (0..765) and the census hamming distance (0..64)
+	 * cost = trans_ad_[ad] - trans_census_[hamming], which is 1 - exp(-ad/lambda_ad) + 1 - exp(-hamming/lambda_census)
+	 * evaluated in the same order (and precision) as the direct formula
+	 */
+	vector<float64> trans_ad_;
+	vector<float64> trans_census_;
+
 	/** \brief СӲֵ */
 	sint32 min_disparity_;
 	/** \brief Ӳֵ */
@@ -0,0 +1,159 @@
+/* -*-c++-*- AD-Census - Copyright (C) 2020.
+* Author	: Yingsong Li(Ethan Li) <ethan.li.whu@gmail.com>
+* https://github.com/ethan-li-coding/AD-Census
+* Describe	: implement of class CostVolume
+*/
+
+#include "cost_volume.h"
+
+#include <cstring>
+
+CostVolume::CostVolume(): type_(CostFloat32), layout_(CostPixelMajor), width_(0), height_(0), disp_range_(0), size_(0), arena_data_(nullptr) { }
+
+CostVolume::~CostVolume()
+{
+
+}
+
+bool CostVolume::Initialize(const sint32& width, const sint32& height, const sint32& disp_range, const CostType& type,
+	const CostLayout& layout, MemoryArena* arena)
+{
+	Release();
+	if (width <= 0 || height <= 0 || disp_range <= 0) {
+		return false;
+	}
+
+	type_ = type;
+	layout_ = layout;
+	width_ = width;
+	height_ = height;
+	disp_range_ = disp_range;
+	size_ = static_cast<size_t>(width) * height * disp_range;
+	if (arena != nullptr) {
+		if (type_ != CostFloat32 && type_ != CostUInt16 && type_ != CostUInt8) {
+			size_ = 0;
+			return false;
+		}
+		arena_data_ = arena->Allocate(bytes());
+		if (arena_data_ == nullptr) {
+			size_ = 0;
+			return false;
+		}
+		return true;
+	}
+	switch (type_) {
+	case CostFloat32:
+		data_f32_.resize(size_);
+		break;
+	case CostUInt16:
+		data_u16_.resize(size_);
+		break;
+	case CostUInt8:
+		data_u8_.resize(size_);
+		break;
+	default:
+		size_ = 0;
+		return false;
+	}
+	return true;
+}
+
+void CostVolume::Release()
+{
+	// swap with empty vectors to really give the memory back
+	vector<float32>().swap(data_f32_);
+	vector<uint16>().swap(data_u16_);
+	vector<uint8>().swap(data_u8_);
+	arena_data_ = nullptr;
+	size_ = 0;
+}
+
+size_t CostVolume::bytes() const
+{
+	switch (type_) {
+	case CostUInt16:
+		return size_ * sizeof(uint16);
+	case CostUInt8:
+		return size_ * sizeof(uint8);
+	default:
+		return size_ * sizeof(float32);
+	}
+}
+
+void* CostVolume::data()
+{
+	switch (type_) {
+	case CostUInt16:
+		return ptr<uint16>();
+	case CostUInt8:
+		return ptr<uint8>();
+	default:
+		return ptr<float32>();
+	}
+}
+
+const void* CostVolume::data() const
+{
+	switch (type_) {
+	case CostUInt16:
+		return ptr<uint16>();
+	case CostUInt8:
+		return ptr<uint8>();
+	default:
+		return ptr<float32>();
+	}
+}
+
+float32 CostVolume::Get(const size_t& idx) const
+{
+	switch (type_) {
+	case CostUInt16:
+		return CostTraits<uint16>::Load(ptr<uint16>()[idx]);
+	case CostUInt8:
+		return CostTraits<uint8>::Load(ptr<uint8>()[idx]);
+	default:
+		return ptr<float32>()[idx];
+	}
+}
+
+bool CostVolume::CopyTo(CostVolume* dst) const
+{
+	if (dst == nullptr || dst == this || dst->type_ != type_ || dst->width_ != width_ ||
+		dst->height_ != height_ || dst->disp_range_ != disp_range_ || size_ == 0) {
+		return false;
+	}
+
+	switch (type_) {
+	case CostUInt16:
+		CopyTo(ptr<uint16>(), dst->ptr<uint16>(), dst->layout_);
+		break;
+	case CostUInt8:
+		CopyTo(ptr<uint8>(), dst->ptr<uint8>(), dst->layout_);
+		break;
+	default:
+		CopyTo(ptr<float32>(), dst->ptr<float32>(), dst->layout_);
+		break;
+	}
+	return true;
+}
+
+template<typename T>
+void CostVolume::CopyTo(const T* src, T* dst, const CostLayout& dst_layout) const
+{
+	if (dst_layout == layout_) {
+		memcpy(dst, src, size_ * sizeof(T));
+		return;
+	}
+
+	// transpose image row by image row, one row is a width*disp_range (pixel-major) or disp_range*width (disparity-major) matrix
+	const size_t slice_size = static_cast<size_t>(width_) * height_;
+	for (sint32 y = 0; y < height_; y++) {
+		const size_t row_offset = static_cast<size_t>(y) * width_;
+		if (layout_ == CostDisparityMajor) {
+			TransposeCosts(src + row_offset, disp_range_, width_, slice_size, dst + row_offset * disp_range_, disp_range_);
+		}
+		else {
+			TransposeCosts(src + row_offset * disp_range_, width_, disp_range_, disp_range_, dst + row_offset, slice_size);
+		}
+	}
+}
@@ -0,0 +1,161 @@
+/* -*-c++-*- AD-Census - Copyright (C) 2020.
+* Author	: Yingsong Li(Ethan Li) <ethan.li.whu@gmail.com>
+* https://github.com/ethan-li-coding/AD-Census
+* Describe	: header of class CostVolume
+*/
+
+#ifndef AD_CENSUS_COST_VOLUME_H_
+#define AD_CENSUS_COST_VOLUME_H_
+
+#include <cstddef>
+
+#include "adcensus_types.h"
+#include "memory_arena.h"
+
+/**
+* \brief conversion between the float cost and the storage type of a cost volume
+* All stages compute in float32; the volume only stores the values, so the float32 path is unchanged.
+* Fixed point types store round(cost * kScale), saturated to [0, max of the type].
+*/
+template<typename T> struct CostTraits;
+
+template<> struct CostTraits<float32> {
+	static float32 Load(const float32& v) { return v; }
+	static float32 Store(const float32& v) { return v; }
+};
+
+template<> struct CostTraits<uint16> {
+	static constexpr float32 kScale = 4096.0f;
+	static float32 Load(const uint16& v) { return v * (1.0f / kScale); }
+	static uint16 Store(const float32& v) {
+		const float32 s = v * kScale + 0.5f;
+		return s <= 0.0f ? 0 : (s >= 65535.0f ? 65535 : static_cast<uint16>(s));
+	}
+};
+
+template<> struct CostTraits<uint8> {
+	static constexpr float32 kScale = 128.0f;
+	static float32 Load(const uint8& v) { return v * (1.0f / kScale); }
+	static uint8 Store(const float32& v) {
+		const float32 s = v * kScale + 0.5f;
+		return s <= 0.0f ? 0 : (s >= 255.0f ? 255 : static_cast<uint8>(s));
+	}
+};
+
+/**
+* \brief transpose a rows*cols matrix into a cols*rows matrix, in tiles so both sides stay in cache
+* \param src			input, element (i,j) at src[i * src_stride + j]
+* \param rows			number of rows of src
+* \param cols			number of columns of src
+* \param src_stride	row stride of src
+* \param dst			output, element (i,j) of src goes to dst[j * dst_stride + i]
+* \param dst_stride	row stride of dst
+*/
+template<typename T>
+void TransposeCosts(const T* src, const sint32& rows, const sint32& cols, const size_t& src_stride, T* dst, const size_t& dst_stride)
+{
+	const sint32 tile = 16;
+	for (sint32 i0 = 0; i0 < rows; i0 += tile) {
+		const sint32 i1 = (i0 + tile < rows) ? i0 + tile : rows;
+		for (sint32 j0 = 0; j0 < cols; j0 += tile) {
+			const sint32 j1 = (j0 + tile < cols) ? j0 + tile : cols;
+			for (sint32 j = j0; j < j1; j++) {
+				T* dst_row = dst + j * dst_stride;
+				for (sint32 i = i0; i < i1; i++) {
+					dst_row[i] = src[i * src_stride + j];
+				}
+			}
+		}
+	}
+}
+
+/**
+ * \brief cost volume of width*height*disp_range costs, stored as float32/uint16/uint8
+ * in pixel-major or disparity-major layout (see CostLayout). Only the storage of the chosen type is allocated.
+ */
+class CostVolume {
+public:
+	CostVolume();
+	~CostVolume();
+
+	/**
+	 * \brief allocate the volume
+	 * \param width			image width
+	 * \param height		image height
+	 * \param disp_range	disparity range
+	 * \param type			storage type
+	 * \param layout		memory layout
+	 * \param arena		arena the storage is taken from, it stays valid until the arena is released, nullptr: own storage
+	 * \return true: success
+	 */
+	bool Initialize(const sint32& width, const sint32& height, const sint32& disp_range, const CostType& type,
+					const CostLayout& layout = CostPixelMajor, MemoryArena* arena = nullptr);
+
+	/** \brief release the memory, storage from an arena is only dropped */
+	void Release();
+
+	/** \brief storage type */
+	CostType type() const { return type_; }
+	/** \brief memory layout */
+	CostLayout layout() const { return layout_; }
+	/** \brief number of costs */
+	size_t size() const { return size_; }
+	/** \brief size of the storage in bytes */
+	size_t bytes() const;
+
+	/** \brief untyped data pointer */
+	void* data();
+	const void* data() const;
+
+	/** \brief typed data pointer, nullptr if T is not the storage type */
+	template<typename T> T* ptr();
+	template<typename T> const T* ptr() const;
+
+	/** \brief read one cost as float (for sparse access, hot loops should use ptr<T>() and CostTraits) */
+	float32 Get(const size_t& idx) const;
+
+	/**
+	 * \brief copy the costs to a volume of the same type and size, transposing if the layouts differ
+	 * \param dst			output volume
+	 * \return true: success
+	 */
+	bool CopyTo(CostVolume* dst) const;
+
+private:
+	template<typename T>
+	void CopyTo(const T* src, T* dst, const CostLayout& dst_layout) const;
+
+	CostType type_;
+	CostLayout layout_;
+	sint32	width_;
+	sint32	height_;
+	sint32	disp_range_;
+	size_t	size_;
+
+	vector<float32> data_f32_;
+	vector<uint16>	data_u16_;
+	vector<uint8>	data_u8_;
+	/** \brief storage taken from an arena, nullptr: the vector of the type */
+	void*	arena_data_;
+};
+
+template<> inline float32* CostVolume::ptr<float32>() {
+	return (type_ == CostFloat32 && size_ > 0) ? (arena_data_ != nullptr ? static_cast<float32*>(arena_data_) : &data_f32_[0]) : nullptr;
+}
+template<> inline uint16* CostVolume::ptr<uint16>() {
+	return (type_ == CostUInt16 && size_ > 0) ? (arena_data_ != nullptr ? static_cast<uint16*>(arena_data_) : &data_u16_[0]) : nullptr;
+}
+template<> inline uint8* CostVolume::ptr<uint8>() {
+	return (type_ == CostUInt8 && size_ > 0) ? (arena_data_ != nullptr ? static_cast<uint8*>(arena_data_) : &data_u8_[0]) : nullptr;
+}
+template<> inline const float32* CostVolume::ptr<float32>() const {
+	return (type_ == CostFloat32 && size_ > 0) ? (arena_data_ != nullptr ? static_cast<const float32*>(arena_data_) : &data_f32_[0]) : nullptr;
+}
+template<> inline const uint16* CostVolume::ptr<uint16>() const {
+	return (type_ == CostUInt16 && size_ > 0) ? (arena_data_ != nullptr ? static_cast<const uint16*>(arena_data_) : &data_u16_[0]) : nullptr;
+}
+template<> inline const uint8* CostVolume::ptr<uint8>() const {
+	return (type_ == CostUInt8 && size_ > 0) ? (arena_data_ != nullptr ? static_cast<const uint8*>(arena_data_) : &data_u8_[0]) : nullptr;
+}
+
+#endif
@@ -5,11 +5,128 @@
 */
 
 #include "cross_aggregator.h"
+#include "adcensus_simd.h"
 #include <cstring>
 
-CrossAggregator::CrossAggregator(): width_(0), height_(0), img_left_(nullptr), img_right_(nullptr),
-                                    cost_init_(nullptr),
-                                    cross_L1_(0), cross_L2_(0), cross_t1_(0), cross_t2_(0),
+namespace
+{
+#if defined(ADCENSUS_X86)
+	/** \brief arm search parameters, max_len is min(L1, MAX_ARM_LENGTH) */
+	struct ArmParams {
+		sint32 max_len, L2, t1, t2;
+	};
+
+	/** \brief 0xff where v < t, t_minus_1 = t - 1 in [0,255] */
+	ADCENSUS_TARGET_AVX2
+	inline __m256i LessThanAvx2(const __m256i& v, const __m256i& t_minus_1)
+	{
+		return _mm256_cmpeq_epi8(_mm256_min_epu8(v, t_minus_1), v);
+	}
+
+	/** \brief ColorDist of 32 pixel pairs, the max of the channel absolute differences */
+	ADCENSUS_TARGET_AVX2
+	inline __m256i ColorDistAvx2(const __m256i* a, const __m256i* b)
+	{
+		__m256i dist = _mm256_or_si256(_mm256_subs_epu8(a[0], b[0]), _mm256_subs_epu8(b[0], a[0]));
+		for (sint32 c = 1; c < 3; c++) {
+			dist = _mm256_max_epu8(dist, _mm256_or_si256(_mm256_subs_epu8(a[c], b[c]), _mm256_subs_epu8(b[c], a[c])));
+		}
+		return dist;
+	}
+
+	/**
+	 * \brief arm lengths of 32 neighbouring pixels in one direction, the stop conditions of
+	 * FindHorizontalArm / FindVerticalArm evaluated for all of them in lockstep
+	 * \param planes		the three color planes
+	 * \param idx			plane index of the first pixel
+	 * \param step		plane offset of the next arm pixel (-1/1: left/right, -width/width: top/bottom)
+	 * \param border		per pixel number of arm pixels before the image border, saturated to 255
+	 * \param max_len		arm length limit
+	 */
+	ADCENSUS_TARGET_AVX2
+	__m256i ArmLengthAvx2(const uint8* const* planes, const sint32& idx, const sint32& step, const __m256i& border,
+		const sint32& max_len, const ArmParams& params)
+	{
+		const __m256i t1 = _mm256_set1_epi8(static_cast<char>(std::min(params.t1 - 1, 255)));
+		const __m256i t2 = _mm256_set1_epi8(static_cast<char>(std::min(params.t2 - 1, 255)));
+		__m256i color0[3], color_last[3];
+		for (sint32 c = 0; c < 3; c++) {
+			color0[c] = color_last[c] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(planes[c] + idx));
+		}
+		__m256i active = _mm256_set1_epi8(-1);
+		__m256i length = _mm256_setzero_si256();
+		for (sint32 n = 1; n <= max_len; n++) {
+			__m256i color[3];
+			for (sint32 c = 0; c < 3; c++) {
+				color[c] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(planes[c] + idx + n * step));
+			}
+			const __m256i dist1 = ColorDistAvx2(color, color0);
+			const __m256i dist2 = ColorDistAvx2(color, color_last);
+			// border >= n
+			__m256i ok = _mm256_cmpeq_epi8(_mm256_max_epu8(border, _mm256_set1_epi8(static_cast<char>(n))), border);
+			ok = _mm256_and_si256(ok, _mm256_and_si256(LessThanAvx2(dist1, t1), LessThanAvx2(dist2, t1)));
+			if (n > params.L2) {
+				ok = _mm256_and_si256(ok, LessThanAvx2(dist1, t2));
+			}
+			active = _mm256_and_si256(active, ok);
+			if (_mm256_testz_si256(active, active)) {
+				break;
+			}
+			length = _mm256_sub_epi8(length, active);
+			for (sint32 c = 0; c < 3; c++) {
+				color_last[c] = color[c];
+			}
+		}
+		return length;
+	}
+
+	/**
+	 * \brief arms of row y, 32 pixels at a time
+	 * \param planes		the three color planes, padded by MAX_ARM_LENGTH + 1 bytes before the first and after the last pixel
+	 * \return the first column that is left for the scalar code
+	 */
+	ADCENSUS_TARGET_AVX2
+	sint32 BuildArmsRowAvx2(const uint8* const* planes, const sint32& width, const sint32& height, const sint32& y,
+		const ArmParams& params, CrossArm* arms)
+	{
+		// the vertical borders are the same for the whole row
+		const sint32 max_top = std::min(params.max_len, y);
+		const sint32 max_bottom = std::min(params.max_len, height - 1 - y);
+		const __m256i no_border = _mm256_set1_epi8(static_cast<char>(0xff));
+
+		sint32 x = 0;
+		for (; x + 32 <= width; x += 32) {
+			uint8 border_left[32], border_right[32];
+			for (sint32 k = 0; k < 32; k++) {
+				border_left[k] = static_cast<uint8>(std::min(x + k, 255));
+				border_right[k] = static_cast<uint8>(std::min(width - 1 - x - k, 255));
+			}
+			const sint32 idx = y * width + x;
+			uint8 length[4][32];
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(length[0]), ArmLengthAvx2(planes, idx, -1,
+				_mm256_loadu_si256(reinterpret_cast<const __m256i*>(border_left)), params.max_len, params));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(length[1]), ArmLengthAvx2(planes, idx, 1,
+				_mm256_loadu_si256(reinterpret_cast<const __m256i*>(border_right)), params.max_len, params));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(length[2]), ArmLengthAvx2(planes, idx, -width, no_border, max_top, params));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(length[3]), ArmLengthAvx2(planes, idx, width, no_border, max_bottom, params));
+			for (sint32 k = 0; k < 32; k++) {
+				CrossArm& arm = arms[idx + k];
+				arm.left = length[0][k];
+				arm.right = length[1][k];
+				arm.top = length[2][k];
+				arm.bottom = length[3][k];
+			}
+		}
+		return x;
+	}
+#endif
+}
+
+CrossAggregator::CrossAggregator(): width_(0), height_(0), cross_arms_(nullptr), img_left_(nullptr), img_right_(nullptr),
+                                    cost_init_(nullptr), thread_pool_(nullptr), arena_(nullptr),
+                                    cost_tmp_{ nullptr, nullptr }, integral_(nullptr), color_planes_(nullptr),
+                                    sup_count_{ nullptr, nullptr }, sup_count_tmp_(nullptr), num_tmp_threads_(0), num_integral_threads_(0),
+                                    cross_L1_(0), cross_L2_(0), cross_t1_(0), cross_t2_(0), aggr_method_(CrossAggrDirect),
                                     min_disparity_(0), max_disparity_(0), is_initialized_(false) { }
 
 CrossAggregator::~CrossAggregator()
@@ -17,7 +134,8 @@ CrossAggregator::~CrossAggregator()
 	
 }
 
-bool CrossAggregator::Initialize(const sint32& width, const sint32& height, const sint32& min_disparity, const sint32& max_disparity)
+bool CrossAggregator::Initialize(const sint32& width, const sint32& height, const sint32& min_disparity, const sint32& max_disparity,
+	const CostType& cost_type)
 {
 	width_ = width;
 	height_ = height;
@@ -32,33 +150,43 @@ bool CrossAggregator::Initialize(const sint32& width, const sint32& height, cons
 	}
 
 	// Ϊ����ʮ�ֱ���������ڴ�
-	vec_cross_arms_.clear();
-	vec_cross_arms_.resize(img_size);
+	cross_arms_ = AllocateBuffer(arena_, vec_cross_arms_, img_size);
 
 	// Ϊ��ʱ������������ڴ�
-	vec_cost_tmp_[0].clear();
-	vec_cost_tmp_[0].resize(img_size);
-	vec_cost_tmp_[1].clear();
-	vec_cost_tmp_[1].resize(img_size);
+	// one slice per thread, thread k uses [k * img_size, (k + 1) * img_size)
+	const sint32 num_threads = thread_pool_ != nullptr ? thread_pool_->num_threads() : 1;
+	cost_tmp_[0] = AllocateBuffer(arena_, vec_cost_tmp_[0], static_cast<size_t>(img_size) * num_threads);
+	cost_tmp_[1] = AllocateBuffer(arena_, vec_cost_tmp_[1], static_cast<size_t>(img_size) * num_threads);
+	num_tmp_threads_ = num_threads;
 
 	// Ϊ�洢ÿ������֧����������������������ڴ�
-	vec_sup_count_[0].clear();
-	vec_sup_count_[0].resize(img_size);
-	vec_sup_count_[1].clear();
-	vec_sup_count_[1].resize(img_size);
-	vec_sup_count_tmp_.clear();
-	vec_sup_count_tmp_.resize(img_size);
+	sup_count_[0] = AllocateBuffer(arena_, vec_sup_count_[0], img_size);
+	sup_count_[1] = AllocateBuffer(arena_, vec_sup_count_[1], img_size);
+	sup_count_tmp_ = AllocateBuffer(arena_, vec_sup_count_tmp_, img_size);
+
+	// the integral images are taken on the first Aggregate with CrossAggrIntegral
+	integral_ = nullptr;
+	num_integral_threads_ = 0;
+	vector<float64>().swap(vec_integral_);
+
+	// the padded color planes of the simd arm search
+	color_planes_ = nullptr;
+#if defined(ADCENSUS_X86)
+	if (adcensus_simd::GetCpuFeatures().avx2) {
+		color_planes_ = AllocateBuffer(arena_, vec_color_planes_, 3 * static_cast<size_t>(img_size + 2 * (MAX_ARM_LENGTH + 1)));
+	}
+#endif
 
 	// Ϊ�ۺϴ�����������ڴ�
-	cost_aggr_.resize(img_size * disp_range);
+	cost_aggr_.Initialize(width_, height_, disp_range, cost_type, CostPixelMajor, arena_);
 
-	is_initialized_ = !vec_cross_arms_.empty() && !vec_cost_tmp_[0].empty() && !vec_cost_tmp_[1].empty() 
-					&& !vec_sup_count_[0].empty() && !vec_sup_count_[1].empty() 
-					&& !vec_sup_count_tmp_.empty() && !cost_aggr_.empty();
+	is_initialized_ = cross_arms_ != nullptr && cost_tmp_[0] != nullptr && cost_tmp_[1] != nullptr
+					&& sup_count_[0] != nullptr && sup_count_[1] != nullptr
+					&& sup_count_tmp_ != nullptr && cost_aggr_.size() > 0;
 	return is_initialized_;
 }
 
-void CrossAggregator::SetData(const uint8* img_left, const uint8* img_right, const float32* cost_init)
+void CrossAggregator::SetData(const uint8* img_left, const uint8* img_right, CostVolume* cost_init)
 {
 	img_left_ = img_left;
 	img_right_ = img_right;
@@ -66,71 +194,147 @@ void CrossAggregator::SetData(const uint8* img_left, const uint8* img_right, con
 }
 
 void CrossAggregator::SetParams(const sint32& cross_L1, const sint32& cross_L2, const sint32& cross_t1,
-	const sint32& cross_t2)
+	const sint32& cross_t2, const CrossAggrMethod& method)
 {
 	cross_L1_ = cross_L1;
 	cross_L2_ = cross_L2;
 	cross_t1_ = cross_t1;
 	cross_t2_ = cross_t2;
+	aggr_method_ = method;
+}
+
+void CrossAggregator::SetThreadPool(ThreadPool* thread_pool)
+{
+	thread_pool_ = thread_pool;
+}
+
+void CrossAggregator::SetArena(MemoryArena* arena)
+{
+	arena_ = arena;
 }
 
 void CrossAggregator::BuildArms() 
 {
-	// �����ؼ���ʮ�ֽ����
-	for (sint32 y = 0; y < height_; y++) {
-		for (sint32 x = 0; x < width_; x++) {
-			CrossArm& arm = vec_cross_arms_[y * width_ + x];
-			FindHorizontalArm(x, y, arm.left, arm.right);
-			FindVerticalArm(x, y, arm.top, arm.bottom);
+#if defined(ADCENSUS_X86)
+	// the simd arm search needs the left image as three padded color planes
+	const bool use_avx2 = color_planes_ != nullptr && cross_t1_ > 0 && cross_t2_ > 0;
+	const uint8* planes[3] = { nullptr, nullptr, nullptr };
+	ArmParams params = { std::min(cross_L1_, MAX_ARM_LENGTH), cross_L2_, cross_t1_, cross_t2_ };
+	if (use_avx2) {
+		const sint32 pad = MAX_ARM_LENGTH + 1;
+		const sint32 plane_size = width_ * height_ + 2 * pad;
+		for (sint32 c = 0; c < 3; c++) {
+			planes[c] = color_planes_ + c * plane_size + pad;
 		}
+		ThreadPool::ParallelFor(thread_pool_, 0, height_, [&](const sint32& y_begin, const sint32& y_end, const sint32&) {
+			for (sint32 i = y_begin * width_; i < y_end * width_; i++) {
+				for (sint32 c = 0; c < 3; c++) {
+					color_planes_[c * plane_size + pad + i] = img_left_[i * 3 + c];
+				}
+			}
+		});
 	}
+#endif
+
+	// �����ؼ���ʮ�ֽ����
+	ThreadPool::ParallelFor(thread_pool_, 0, height_, [&](const sint32& y_begin, const sint32& y_end, const sint32&) {
+		for (sint32 y = y_begin; y < y_end; y++) {
+			sint32 x = 0;
+#if defined(ADCENSUS_X86)
+			if (use_avx2) {
+				x = BuildArmsRowAvx2(planes, width_, height_, y, params, cross_arms_);
+			}
+#endif
+			for (; x < width_; x++) {
+				CrossArm& arm = cross_arms_[y * width_ + x];
+				FindHorizontalArm(x, y, arm.left, arm.right);
+				FindVerticalArm(x, y, arm.top, arm.bottom);
+			}
+		}
+	});
 }
 
 
 void CrossAggregator::Aggregate(const sint32& num_iters)
 {
-	if (!is_initialized_) {
+	if (!is_initialized_ || cost_init_ == nullptr || cost_init_->type() != cost_aggr_.type() || cost_init_->size() != cost_aggr_.size()) {
 		return;
 	}
 
-	const sint32 disp_range = max_disparity_ - min_disparity_;
+	// one temporary slice (and integral image) per thread
+	const sint32 img_size = width_ * height_;
+	const sint32 num_threads = thread_pool_ != nullptr ? thread_pool_->num_threads() : 1;
+	// a changed thread count takes new buffers, the old ones of an arena stay until it is released
+	if (num_tmp_threads_ != num_threads) {
+		cost_tmp_[0] = AllocateBuffer(arena_, vec_cost_tmp_[0], static_cast<size_t>(img_size) * num_threads);
+		cost_tmp_[1] = AllocateBuffer(arena_, vec_cost_tmp_[1], static_cast<size_t>(img_size) * num_threads);
+		num_tmp_threads_ = num_threads;
+	}
+	if (aggr_method_ == CrossAggrIntegral) {
+		if (num_integral_threads_ != num_threads) {
+			integral_ = AllocateBuffer(arena_, vec_integral_, static_cast<size_t>(integral_size()) * num_threads);
+			num_integral_threads_ = num_threads;
+		}
+	}
+	else if (arena_ == nullptr) {
+		vector<float64>().swap(vec_integral_);
+		integral_ = nullptr;
+		num_integral_threads_ = 0;
+	}
 
 	// �������ص�ʮ�ֽ����
 	BuildArms();
 
 	// ���۾ۺ�
-	// horizontal_first ������ˮƽ����ۺ�
-	bool horizontal_first = true;
-
 	// �������־ۺϷ���ĸ�����֧������������
 	ComputeSupPixelCount();
 
 	// �Ƚ��ۺϴ��۳�ʼ��Ϊ��ʼ����
-	memcpy(&cost_aggr_[0], cost_init_, width_*height_*disp_range*sizeof(float32));
+	// pixel-major: aggregate a copy of the initial costs in cost_aggr_
+	// disparity-major: aggregate the contiguous slices of the initial costs in place, then transpose them to cost_aggr_
+	CostVolume* cost = (cost_init_->layout() == CostDisparityMajor) ? cost_init_ : &cost_aggr_;
+	if (cost == &cost_aggr_) {
+		cost_init_->CopyTo(&cost_aggr_);
+	}
 
 	// ������ۺ�
-	for (sint32 k = 0; k < num_iters; k++) {
-		for (sint32 d = min_disparity_; d < max_disparity_; d++) {
-			AggregateInArms(d, horizontal_first);
+	// the disparities are independent, every thread aggregates a contiguous block of them in its own temporary slices
+	// all iterations of a disparity run on its slice in the temporary buffers, the slice is read and written once
+	ThreadPool::ParallelFor(thread_pool_, min_disparity_, max_disparity_,
+		[&](const sint32& d_begin, const sint32& d_end, const sint32& thread_id) {
+		for (sint32 d = d_begin; d < d_end; d++) {
+			switch (cost->type()) {
+			case CostUInt16:
+				AggregateInArms<uint16>(cost, d, num_iters, thread_id);
+				break;
+			case CostUInt8:
+				AggregateInArms<uint8>(cost, d, num_iters, thread_id);
+				break;
+			default:
+				AggregateInArms<float32>(cost, d, num_iters, thread_id);
+				break;
+			}
 		}
-		// ��һ�ε���������˳��
-		horizontal_first = !horizontal_first;
+	});
+
+	if (cost != &cost_aggr_) {
+		cost_init_->CopyTo(&cost_aggr_);
 	}
 }
 
 CrossArm* CrossAggregator::get_arms_ptr()
 {
-	return &vec_cross_arms_[0];
+	return cross_arms_;
 }
 
 float32* CrossAggregator::get_cost_ptr()
 {
-	if (!cost_aggr_.empty()) {
-		return &cost_aggr_[0];
-	}
-	else {
-		return nullptr;
-	}
+	return cost_aggr_.ptr<float32>();
+}
+
+CostVolume* CrossAggregator::get_cost_volume()
+{
+	return &cost_aggr_;
 }
 
 void CrossAggregator::FindHorizontalArm(const sint32& x, const sint32& y, uint8& left, uint8& right) const
@@ -274,58 +478,77 @@ void CrossAggregator::ComputeSupPixelCount()
 	// ����ÿ�����ص�֧������������
 	// ע�⣺���ֲ�ͬ�ľۺϷ������ص�֧���������ǲ�ͬ�ģ���Ҫ�ֿ�����
 	bool horizontal_first = true;
+	if (aggr_method_ == CrossAggrIntegral) {
+		// pass1 counts are the arm lengths, pass2 sums them along the other arm with an integral image
+		const sint32 img_size = width_ * height_;
+		for (sint32 n = 0; n < 2; n++) {
+			const sint32 id = horizontal_first ? 0 : 1;
+			for (sint32 i = 0; i < img_size; i++) {
+				const auto& arm = cross_arms_[i];
+				sup_count_tmp_[i] = horizontal_first ? arm.left + arm.right + 1 : arm.top + arm.bottom + 1;
+			}
+			SumInArmsIntegral(sup_count_tmp_, sup_count_[id], !horizontal_first, integral_);
+			horizontal_first = !horizontal_first;
+		}
+		return;
+	}
 	for (sint32 n = 0; n < 2; n++) {
 		// n=0 : horizontal_first; n=1 : vertical_first
 		const sint32 id = horizontal_first ? 0 : 1;
 		for (sint32 k = 0; k < 2; k++) {
 			// k=0 : pass1; k=1 : pass2
-			for (sint32 y = 0; y < height_; y++) {
-				for (sint32 x = 0; x < width_; x++) {
-					// ��ȡarm��ֵ
-					auto& arm = vec_cross_arms_[y*width_ + x];
-					sint32 count = 0;
-					if (horizontal_first) {
-						if (k == 0) {
-							// horizontal
-							for (sint32 t = -arm.left; t <= arm.right; t++) {
-								count++;
+			// every pass is one parallel loop over the rows, pass2 reads the pass1 results of the neighbouring rows
+			ThreadPool::ParallelFor(thread_pool_, 0, height_, [&](const sint32& y_begin, const sint32& y_end, const sint32&) {
+				for (sint32 y = y_begin; y < y_end; y++) {
+					for (sint32 x = 0; x < width_; x++) {
+						// ��ȡarm��ֵ
+						auto& arm = cross_arms_[y*width_ + x];
+						sint32 count = 0;
+						if (horizontal_first) {
+							if (k == 0) {
+								// horizontal
+								for (sint32 t = -arm.left; t <= arm.right; t++) {
+									count++;
+								}
+							}
+							else {
+								// vertical
+								for (sint32 t = -arm.top; t <= arm.bottom; t++) {
+									count += sup_count_tmp_[(y + t)*width_ + x];
+								}
 							}
 						}
 						else {
-							// vertical
-							for (sint32 t = -arm.top; t <= arm.bottom; t++) {
-								count += vec_sup_count_tmp_[(y + t)*width_ + x];
+							if (k == 0) {
+								// vertical
+								for (sint32 t = -arm.top; t <= arm.bottom; t++) {
+									count++;
+								}
+							}
+							else {
+								// horizontal
+								for (sint32 t = -arm.left; t <= arm.right; t++) {
+									count += sup_count_tmp_[y*width_ + x + t];
+								}
 							}
 						}
-					}
-					else {
 						if (k == 0) {
-							// vertical
-							for (sint32 t = -arm.top; t <= arm.bottom; t++) {
-								count++;
-							}
+							sup_count_tmp_[y*width_ + x] = count;
 						}
 						else {
-							// horizontal
-							for (sint32 t = -arm.left; t <= arm.right; t++) {
-								count += vec_sup_count_tmp_[y*width_ + x + t];
-							}
+							sup_count_[id][y*width_ + x] = count;
 						}
 					}
-					if (k == 0) {
-						vec_sup_count_tmp_[y*width_ + x] = count;
-					}
-					else {
-						vec_sup_count_[id][y*width_ + x] = count;
-					}
 				}
-			}
+			});
 		}
 		horizontal_first = !horizontal_first;
 	}
 }
 
-void CrossAggregator::AggregateInArms(const sint32& disparity, const bool& horizontal_first)
+template<typename T>
+void CrossAggregator::AggregateInArms(CostVolume* cost_volume, const sint32& disparity, const sint32& num_iters,
+	const sint32& thread_id)
 {
 	// �˺����ۺ��������ص��Ӳ�Ϊdisparityʱ�Ĵ���
 
@@ -334,61 +557,135 @@ void CrossAggregator::AggregateInArms(const sint32& disparity, const bool& horiz
 	}
 	const auto disp = disparity - min_disparity_;
 	const sint32 disp_range = max_disparity_ - min_disparity_;
-	if (disp_range <= 0) {
+	if (disp_range <= 0 || num_iters <= 0) {
 		return;
 	}
 
+	// the costs of disparity disp are slice[(y * width_ + x) * pixel_stride]
+	const bool disparity_major = cost_volume->layout() == CostDisparityMajor;
+	T* slice = disparity_major ? cost_volume->ptr<T>() + disp * width_ * height_ : cost_volume->ptr<T>() + disp;
+	const sint32 pixel_stride = disparity_major ? 1 : disp_range;
+
 	// ��disp��Ĵ��۴�����ʱ����vec_cost_tmp_[0]
 	// �������Ա������ķ��ʸ����cost_aggr_,��߷���Ч��
-	for (sint32 y = 0; y < height_; y++) {
-		for (sint32 x = 0; x < width_; x++) {
-			vec_cost_tmp_[0][y * width_ + x] = cost_aggr_[y * width_ * disp_range + x * disp_range + disp];
+	const sint32 img_size = width_ * height_;
+	float32* cost_tmp[2] = { cost_tmp_[0] + thread_id * img_size, cost_tmp_[1] + thread_id * img_size };
+	if (disparity_major) {
+		for (sint32 i = 0; i < img_size; i++) {
+			cost_tmp[0][i] = CostTraits<T>::Load(slice[i]);
+		}
+	}
+	else {
+		for (sint32 i = 0; i < img_size; i++) {
+			cost_tmp[0][i] = CostTraits<T>::Load(slice[i * pixel_stride]);
 		}
 	}
 
-	// �����ؾۺ�
-	const sint32 ct_id = horizontal_first ? 0 : 1;
-	for (sint32 k = 0; k < 2; k++) {
-		// k==0: pass1
-		// k==1: pass2
-		for (sint32 y = 0; y < height_; y++) {
-			for (sint32 x = 0; x < width_; x++) {
-				// ��ȡarm��ֵ
-				auto& arm = vec_cross_arms_[y*width_ + x];
-				// �ۺ�
-				float32 cost = 0.0f;
-				if (horizontal_first) {
-					if (k == 0) {
-						// horizontal
-						for (sint32 t = -arm.left; t <= arm.right; t++) {
-							cost += vec_cost_tmp_[0][y * width_ + x + t];
+	// horizontal_first ������ˮƽ����ۺ�
+	bool horizontal_first = true;
+	for (sint32 n = 0; n < num_iters; n++) {
+		const sint32 ct_id = horizontal_first ? 0 : 1;
+		if (aggr_method_ == CrossAggrIntegral) {
+			// pass1: cost_tmp[0] -> cost_tmp[1], pass2: cost_tmp[1] -> cost_tmp[0]
+			float64* integral = integral_ + thread_id * integral_size();
+			SumInArmsIntegral(cost_tmp[0], cost_tmp[1], horizontal_first, integral);
+			SumInArmsIntegral(cost_tmp[1], cost_tmp[0], !horizontal_first, integral);
+			for (sint32 i = 0; i < img_size; i++) {
+				cost_tmp[0][i] /= sup_count_[ct_id][i];
+			}
+		}
+		else {
+			// �����ؾۺ�
+			for (sint32 k = 0; k < 2; k++) {
+				// k==0: pass1
+				// k==1: pass2
+				for (sint32 y = 0; y < height_; y++) {
+					for (sint32 x = 0; x < width_; x++) {
+						// ��ȡarm��ֵ
+						auto& arm = cross_arms_[y*width_ + x];
+						// �ۺ�
+						float32 cost = 0.0f;
+						if (horizontal_first) {
+							if (k == 0) {
+								// horizontal
+								for (sint32 t = -arm.left; t <= arm.right; t++) {
+									cost += cost_tmp[0][y * width_ + x + t];
+								}
+							} else {
+								// vertical
+								for (sint32 t = -arm.top; t <= arm.bottom; t++) {
+									cost += cost_tmp[1][(y + t)*width_ + x];
+								}
+							}
 						}
-					} else {
-						// vertical
-						for (sint32 t = -arm.top; t <= arm.bottom; t++) {
-							cost += vec_cost_tmp_[1][(y + t)*width_ + x];
+						else {
+							if (k == 0) {
+								// vertical
+								for (sint32 t = -arm.top; t <= arm.bottom; t++) {
+									cost += cost_tmp[0][(y + t) * width_ + x];
+								}
+							} else {
+								// horizontal
+								for (sint32 t = -arm.left; t <= arm.right; t++) {
+									cost += cost_tmp[1][y*width_ + x + t];
+								}
+							}
 						}
-					}
-				}
-				else {
-					if (k == 0) {
-						// vertical
-						for (sint32 t = -arm.top; t <= arm.bottom; t++) {
-							cost += vec_cost_tmp_[0][(y + t) * width_ + x];
+						if (k == 0) {
+							cost_tmp[1][y*width_ + x] = cost;
 						}
-					} else {
-						// horizontal
-						for (sint32 t = -arm.left; t <= arm.right; t++) {
-							cost += vec_cost_tmp_[1][y*width_ + x + t];
+						else {
+							cost_tmp[0][y*width_ + x] = cost / sup_count_[ct_id][y*width_ + x];
 						}
 					}
 				}
-				if (k == 0) {
-					vec_cost_tmp_[1][y*width_ + x] = cost;
-				}
-				else {
-					cost_aggr_[y*width_*disp_range + x*disp_range + disp] = cost / vec_sup_count_[ct_id][y*width_ + x];
-				}
+			}
+		}
+		// ��һ�ε���������˳��
+		horizontal_first = !horizontal_first;
+	}
+
+	// write the aggregated slice back
+	for (sint32 i = 0; i < img_size; i++) {
+		slice[i * pixel_stride] = CostTraits<T>::Store(cost_tmp[0][i]);
+	}
+}
+
+template<typename T>
+void CrossAggregator::SumInArmsIntegral(const T* src, T* dst, const bool& horizontal, float64* integral) const
+{
+	// the prefix sums are accumulated in float64, their differences keep the precision of a direct float32 sum
+	if (horizontal) {
+		// integral[x + 1] = src(0, y) + ... + src(x, y), one row at a time
+		for (sint32 y = 0; y < height_; y++) {
+			const T* src_row = src + y * width_;
+			T* dst_row = dst + y * width_;
+			const CrossArm* arms = &cross_arms_[y * width_];
+			integral[0] = 0.0;
+			for (sint32 x = 0; x < width_; x++) {
+				integral[x + 1] = integral[x] + src_row[x];
+			}
+			for (sint32 x = 0; x < width_; x++) {
+				dst_row[x] = static_cast<T>(integral[x + arms[x].right + 1] - integral[x - arms[x].left]);
+			}
+		}
+	}
+	else {
+		// integral[(y + 1) * width_ + x] = src(x, 0) + ... + src(x, y), built row by row
+		std::fill(integral, integral + width_, 0.0);
+		for (sint32 y = 0; y < height_; y++) {
+			const float64* last = integral + y * width_;
+			float64* cur = integral + (y + 1) * width_;
+			const T* src_row = src + y * width_;
+			for (sint32 x = 0; x < width_; x++) {
+				cur[x] = last[x] + src_row[x];
+			}
+		}
+		for (sint32 y = 0; y < height_; y++) {
+			T* dst_row = dst + y * width_;
+			const CrossArm* arms = &cross_arms_[y * width_];
+			for (sint32 x = 0; x < width_; x++) {
+				dst_row[x] = static_cast<T>(integral[(y + arms[x].bottom + 1) * width_ + x] - integral[(y - arms[x].top) * width_ + x]);
 			}
 		}
 	}
@@ -8,6 +8,9 @@
 #define AD_CENSUS_CROSS_AGGREGATOR_H_
 
 #include "adcensus_types.h"
+#include "cost_volume.h"
+#include "memory_arena.h"
+#include "thread_pool.h"
 #include <algorithm>
 
 /**
@@ -33,17 +36,20 @@ public:
 	 * \brief ʼ۾ۺ
 	 * \param width		Ӱ
 	 * \param height	Ӱ
+	 * \param cost_type	cost volume storage type
 	 * \return true:ʼɹ
 	 */
-	bool Initialize(const sint32& width, const sint32& height, const sint32& min_disparity, const sint32& max_disparity);
+	bool Initialize(const sint32& width, const sint32& height, const sint32& min_disparity, const sint32& max_disparity,
+					const CostType& cost_type = CostFloat32);
 
 	/**
 	 * \brief ô۾ۺ
 	 * \param img_left		// Ӱݣͨ
 	 * \param img_right		// Ӱݣͨ
 	 * \param cost_init		// ʼ
+	 * \note a disparity-major cost_init is aggregated in place, its costs are overwritten
 	 */
-	void SetData(const uint8* img_left, const uint8* img_right, const float32* cost_init);
+	void SetData(const uint8* img_left, const uint8* img_right, CostVolume* cost_init);
 
 	/**
 	 * \brief ô۾ۺĲ
@@ -51,10 +57,29 @@ public:
 	 * \param cross_L2		// L2
 	 * \param cross_t1		// t1
 	 * \param cross_t2		// t2
+	 * \param method		// aggregation method
 	 */
-	void SetParams(const sint32& cross_L1, const sint32& cross_L2, const sint32& cross_t1, const sint32& cross_t2);
+	void SetParams(const sint32& cross_L1, const sint32& cross_L2, const sint32& cross_t1, const sint32& cross_t2,
+				   const CrossAggrMethod& method = CrossAggrDirect);
 
-	/** \brief ۺ */
+	/**
+	 * \brief set the thread pool the aggregation runs on, the disparities are split between the threads
+	 * \param thread_pool	thread pool, nullptr: run on the calling thread
+	 */
+	void SetThreadPool(ThreadPool* thread_pool);
+
+	/**
+	 * \brief set the arena the aggregated cost volume and the buffers are taken from, before Initialize
+	 * The per thread buffers are taken again if the thread count changes, the integral images on the first Aggregate
+	 * with CrossAggrIntegral.
+	 * \param arena		memory arena, nullptr: the volume and the buffers allocate their own storage
+	 */
+	void SetArena(MemoryArena* arena);
+
+	/**
+	 * \brief ۺ
+	 * \param num_iters	number of iterations, the arm directions alternate between them
+	 */
 	void Aggregate(const sint32& num_iters);
 
 	/** \brief ȡصʮָֽ */
@@ -62,6 +87,9 @@ public:
 
 	/** \brief ȡۺϴָ */
 	float32* get_cost_ptr();
+
+	/** \brief aggregated cost volume */
+	CostVolume* get_cost_volume();
 private:
 	/** \brief ʮֽ */
 	void BuildArms();
@@ -72,7 +100,19 @@ private:
 	/** \brief ص֧ */
 	void ComputeSupPixelCount();
 	/** \brief ۺĳӲ */
-	void AggregateInArms(const sint32& disparity, const bool& horizontal_first);
+	template<typename T>
+	void AggregateInArms(CostVolume* cost_volume, const sint32& disparity, const sint32& num_iters, const sint32& thread_id);
+	/**
+	 * \brief sum src along the horizontal or the vertical arm of every pixel with an integral image
+	 * \param src			input, width_ * height_
+	 * \param dst			output sums, width_ * height_
+	 * \param horizontal	true: left/right arms, false: top/bottom arms
+	 * \param integral		buffer of integral_size() elements
+	 */
+	template<typename T>
+	void SumInArmsIntegral(const T* src, T* dst, const bool& horizontal, float64* integral) const;
+	/** \brief number of elements of one integral image buffer */
+	sint32 integral_size() const { return (width_ + 1) * (height_ + 1); }
 
 	/** \brief ɫ */
 	inline sint32 ColorDist(const ADColor& c1,const ADColor& c2) const {
@@ -84,20 +124,40 @@ private:
 	sint32	height_;
 
 	/** \brief  */
-	vector<CrossArm> vec_cross_arms_;
+	CrossArm* cross_arms_;
 
 	/** \brief Ӱ */
 	const uint8* img_left_;
 	const uint8* img_right_;
 
 	/** \brief ʼָ */
-	const float32* cost_init_;
+	CostVolume* cost_init_;
 	/** \brief ۺϴ */
-	vector<float32> cost_aggr_;
+	CostVolume cost_aggr_;
+
+	/** \brief thread pool, nullptr: single threaded */
+	ThreadPool* thread_pool_;
+	/** \brief arena of the aggregated cost volume and the buffers, nullptr: own storage */
+	MemoryArena* arena_;
 
 	/** \brief ʱ */
-	vector<float32> vec_cost_tmp_[2];
+	float32* cost_tmp_[2];	// one slice per thread
+	/** \brief integral image buffers of CrossAggrIntegral, one per thread */
+	float64* integral_;
+	/** \brief padded color planes of the left image for the simd arm search */
+	uint8* color_planes_;
 	/** \brief ֧ 0ˮƽ 1ֱ */
+	uint16* sup_count_[2];
+	uint16* sup_count_tmp_;
+	/** \brief thread count of the slices of cost_tmp_ and of integral_, 0: integral_ is not allocated */
+	sint32 num_tmp_threads_;
+	sint32 num_integral_threads_;
+
+	/** \brief storage of the buffers above without an arena */
+	vector<CrossArm> vec_cross_arms_;
+	vector<float32> vec_cost_tmp_[2];
+	vector<float64> vec_integral_;
+	vector<uint8> vec_color_planes_;
 	vector<uint16> vec_sup_count_[2];
 	vector<uint16> vec_sup_count_tmp_;
 
@@ -105,6 +165,7 @@ private:
 	sint32  cross_L2_;			// ʮֽ洰ڵĿռL2
 	sint32	cross_t1_;			// ʮֽ洰ڵɫt1
 	sint32  cross_t2_;			// ʮֽ洰ڵɫt2
+	CrossAggrMethod aggr_method_;	// aggregation method
 	sint32  min_disparity_;			// СӲ
 	sint32	max_disparity_;			// Ӳ
 
@@ -0,0 +1,116 @@
+/* -*-c++-*- AD-Census - Copyright (C) 2020.
+* Author	: Yingsong Li(Ethan Li) <ethan.li.whu@gmail.com>
+* https://github.com/ethan-li-coding/AD-Census
+* Describe	: implement of class MemoryArena
+*/
+
+#include "memory_arena.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+namespace
+{
+	/** \brief size of a huge page */
+	const size_t Huge_Page_Size = 2 << 20;
+
+	/** \brief n rounded up to a multiple of alignment (a power of 2) */
+	inline size_t AlignUp(const size_t& n, const size_t& alignment)
+	{
+		return (n + alignment - 1) & ~(alignment - 1);
+	}
+}
+
+const size_t MemoryArena::kAlignment;
+const size_t MemoryArena::kBlockSize;
+
+MemoryArena::MemoryArena(): huge_pages_(false), footprint_(0), used_(0) { }
+
+MemoryArena::~MemoryArena()
+{
+	Release();
+}
+
+void MemoryArena::SetHugePages(const bool& huge_pages)
+{
+	huge_pages_ = huge_pages;
+}
+
+void* MemoryArena::Allocate(const size_t& bytes)
+{
+	if (bytes == 0) {
+		return nullptr;
+	}
+
+	const size_t size = AlignUp(bytes, kAlignment);
+	if (blocks_.empty() || blocks_.back().size - blocks_.back().used < size) {
+		if (!AddBlock(std::max(size, kBlockSize))) {
+			return nullptr;
+		}
+	}
+
+	Block& block = blocks_.back();
+	void* region = block.data + block.used;
+	block.used += size;
+	used_ += size;
+	return region;
+}
+
+void MemoryArena::Release()
+{
+	for (auto& block : blocks_) {
+#if defined(__linux__)
+		if (block.mapped) {
+			munmap(block.raw, block.raw_size);
+			continue;
+		}
+#endif
+		free(block.raw);
+	}
+	blocks_.clear();
+	footprint_ = 0;
+	used_ = 0;
+}
+
+bool MemoryArena::AddBlock(const size_t& size)
+{
+	Block block;
+	block.used = 0;
+	block.mapped = false;
+
+#if defined(__linux__)
+	if (huge_pages_) {
+		// map one huge page more to align the start, anonymous mappings are zeroed
+		block.size = AlignUp(size, Huge_Page_Size);
+		block.raw_size = block.size + Huge_Page_Size;
+		void* raw = mmap(nullptr, block.raw_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (raw != MAP_FAILED) {
+			block.raw = raw;
+			block.data = reinterpret_cast<uint8*>(AlignUp(reinterpret_cast<size_t>(raw), Huge_Page_Size));
+			block.mapped = true;
+#if defined(MADV_HUGEPAGE)
+			madvise(block.data, block.size, MADV_HUGEPAGE);
+#endif
+			blocks_.push_back(block);
+			footprint_ += block.raw_size;
+			return true;
+		}
+	}
+#endif
+
+	// calloc gives zeroed memory, large blocks are mapped lazily by the system
+	block.size = size;
+	block.raw_size = size + kAlignment;
+	block.raw = calloc(block.raw_size, 1);
+	if (block.raw == nullptr) {
+		return false;
+	}
+	block.data = reinterpret_cast<uint8*>(AlignUp(reinterpret_cast<size_t>(block.raw), kAlignment));
+	blocks_.push_back(block);
+	footprint_ += block.raw_size;
+	return true;
+}
@@ -0,0 +1,93 @@
+/* -*-c++-*- AD-Census - Copyright (C) 2020.
+* Author	: Yingsong Li(Ethan Li) <ethan.li.whu@gmail.com>
+* https://github.com/ethan-li-coding/AD-Census
+* Describe	: header of class MemoryArena
+*/
+
+#ifndef AD_CENSUS_MEMORY_ARENA_H_
+#define AD_CENSUS_MEMORY_ARENA_H_
+
+#include <cstddef>
+
+#include "adcensus_types.h"
+
+/**
+ * \brief arena of the per-frame buffers: hands out zeroed, kAlignment aligned regions and frees them all at once
+ * Small regions share blocks of kBlockSize bytes, a larger region gets a block of its own, so every region is contiguous.
+ * With huge pages the blocks are 2MB aligned and advised as transparent huge pages (Linux only, ignored elsewhere).
+ */
+class MemoryArena {
+public:
+	MemoryArena();
+	~MemoryArena();
+
+	/** \brief alignment of every region in bytes */
+	static const size_t kAlignment = 64;
+	/** \brief size of the blocks shared by small regions */
+	static const size_t kBlockSize = 1 << 20;
+
+	/**
+	 * \brief back the blocks allocated from now on with huge pages
+	 * \param huge_pages	true: 2MB aligned blocks advised as transparent huge pages
+	 */
+	void SetHugePages(const bool& huge_pages);
+
+	/**
+	 * \brief allocate a zeroed region
+	 * \param bytes		size of the region
+	 * \return kAlignment aligned region, nullptr if bytes is 0 or the allocation failed
+	 */
+	void* Allocate(const size_t& bytes);
+
+	/** \brief allocate a zeroed region of n elements of type T */
+	template<typename T>
+	T* Allocate(const size_t& n) { return static_cast<T*>(Allocate(n * sizeof(T))); }
+
+	/** \brief free all regions */
+	void Release();
+
+	/** \brief bytes of all blocks taken from the system */
+	size_t footprint() const { return footprint_; }
+	/** \brief bytes handed out, including the alignment padding */
+	size_t used() const { return used_; }
+
+private:
+	MemoryArena(const MemoryArena&);
+	MemoryArena& operator=(const MemoryArena&);
+
+	/** \brief block of memory, the regions are taken from [data, data + size) in order */
+	struct Block {
+		void* raw;			// pointer returned by the system
+		size_t raw_size;	// size of the raw allocation
+		uint8* data;		// first aligned byte
+		size_t size;		// usable bytes from data
+		size_t used;		// bytes handed out
+		bool mapped;		// raw comes from mmap
+	};
+
+	/** \brief add a block of at least size usable bytes */
+	bool AddBlock(const size_t& size);
+
+	vector<Block> blocks_;
+	bool	huge_pages_;
+	size_t	footprint_;
+	size_t	used_;
+};
+
+/**
+ * \brief n zeroed elements of type T from the arena, or from storage if there is no arena
+ * A region of the arena stays until the arena is released, storage is freed when the arena is used.
+ * \return the elements, nullptr if n is 0 or the allocation failed
+ */
+template<typename T>
+T* AllocateBuffer(MemoryArena* arena, vector<T>& storage, const size_t& n)
+{
+	if (arena != nullptr) {
+		vector<T>().swap(storage);
+		return arena->Allocate<T>(n);
+	}
+	storage.assign(n, T());
+	return storage.empty() ? nullptr : &storage[0];
+}
+
+#endif
@@ -5,17 +5,78 @@
 */
 
 #include "multistep_refiner.h"
+#include "adcensus_simd.h"
 #include "adcensus_util.h"
+#include <algorithm>
 #include <cmath>
 #include <cstring>
 
+namespace
+{
+	/**
+	* \brief sobel edges of one disparity row, edge[x] = 1 if |gx| + |gy| > threshold for the 3x3 window of the columns
+	* x - 1, x, x + 1 of the rows r0, r1, r2, x in [0, n). A window with an invalid disparity has an infinite or NaN
+	* gradient, only an infinite one is an edge.
+	*/
+	typedef void(*EdgeRowFunc)(const float32* r0, const float32* r1, const float32* r2, uint8* edge, const sint32& n, const float32& threshold);
+
+	void EdgeRowScalar(const float32* r0, const float32* r1, const float32* r2, uint8* edge, const sint32& n, const float32& threshold)
+	{
+		for (sint32 x = 0; x < n; x++) {
+			const float32 grad_x = ((r0[x + 1] - r0[x - 1]) + (2 * r1[x + 1] - 2 * r1[x - 1])) + (r2[x + 1] - r2[x - 1]);
+			const float32 grad_y = (r2[x - 1] + 2 * r2[x] + r2[x + 1]) - (r0[x - 1] + 2 * r0[x] + r0[x + 1]);
+			edge[x] = (std::abs(grad_x) + std::abs(grad_y) > threshold) ? 1 : 0;
+		}
+	}
+
+#if defined(ADCENSUS_X86)
+	/** \brief 8 pixels per iteration, the three columns of a lane are loaded from shifted addresses */
+	ADCENSUS_TARGET_AVX2
+	void EdgeRowAvx2(const float32* r0, const float32* r1, const float32* r2, uint8* edge, const sint32& n, const float32& threshold)
+	{
+		const __m256 two = _mm256_set1_ps(2.0f);
+		const __m256 sign = _mm256_set1_ps(-0.0f);
+		const __m256 thres = _mm256_set1_ps(threshold);
+		sint32 x = 0;
+		for (; x + 8 <= n; x += 8) {
+			const __m256 a0 = _mm256_loadu_ps(r0 + x - 1), a1 = _mm256_loadu_ps(r0 + x), a2 = _mm256_loadu_ps(r0 + x + 1);
+			const __m256 b0 = _mm256_loadu_ps(r1 + x - 1), b2 = _mm256_loadu_ps(r1 + x + 1);
+			const __m256 c0 = _mm256_loadu_ps(r2 + x - 1), c1 = _mm256_loadu_ps(r2 + x), c2 = _mm256_loadu_ps(r2 + x + 1);
+			const __m256 grad_x = _mm256_add_ps(_mm256_add_ps(_mm256_sub_ps(a2, a0), _mm256_sub_ps(_mm256_mul_ps(two, b2), _mm256_mul_ps(two, b0))),
+				_mm256_sub_ps(c2, c0));
+			const __m256 grad_y = _mm256_sub_ps(_mm256_add_ps(_mm256_add_ps(c0, _mm256_mul_ps(two, c1)), c2),
+				_mm256_add_ps(_mm256_add_ps(a0, _mm256_mul_ps(two, a1)), a2));
+			const __m256 grad = _mm256_add_ps(_mm256_andnot_ps(sign, grad_x), _mm256_andnot_ps(sign, grad_y));
+			const sint32 mask = _mm256_movemask_ps(_mm256_cmp_ps(grad, thres, _CMP_GT_OQ));
+			for (sint32 i = 0; i < 8; i++) {
+				edge[x + i] = static_cast<uint8>((mask >> i) & 1);
+			}
+		}
+		EdgeRowScalar(r0 + x, r1 + x, r2 + x, edge + x, n - x, threshold);
+	}
+#endif
+
+	/** \brief the best edge kernel the cpu supports */
+	EdgeRowFunc SelectEdgeRowFunc()
+	{
+#if defined(ADCENSUS_X86)
+		if (adcensus_simd::GetCpuFeatures().avx2) {
+			return EdgeRowAvx2;
+		}
+#endif
+		return EdgeRowScalar;
+	}
+}
+
 MultiStepRefiner::MultiStepRefiner(): width_(0), height_(0), img_left_(nullptr), cost_(nullptr),
-                                      cross_arms_(nullptr),
+                                      cross_arms_(nullptr), thread_pool_(nullptr), arena_(nullptr),
                                       disp_left_(nullptr), disp_right_(nullptr),
                                       min_disparity_(0), max_disparity_(0),
                                       irv_ts_(0), irv_th_(0), lrcheck_thres_(0),
                                       do_lr_check_(false), do_region_voting_(false),
-                                      do_interpolating_(false), do_discontinuity_adjustment_(false) { }
+                                      do_interpolating_(false), do_discontinuity_adjustment_(false),
+                                      outlier_label_(nullptr), histograms_(nullptr), edge_rows_(nullptr),
+                                      num_edge_row_threads_(0), histograms_size_(0) { }
 
 MultiStepRefiner::~MultiStepRefiner()
 {
@@ -29,14 +90,21 @@ bool MultiStepRefiner::Initialize(const sint32& width, const sint32& height)
 		return false;
 	}
 
-	// ��ʼ����Ե����
-	vec_edge_left_.clear();
-	vec_edge_left_.resize(width*height);
+	// outlier labels
+	outlier_label_ = AllocateBuffer(arena_, vec_outlier_label_, static_cast<size_t>(width) * height);
+	if (outlier_label_ == nullptr) {
+		return false;
+	}
+
+	// per thread buffers, the histograms follow the disparity range in Refine
+	num_edge_row_threads_ = 0;
+	histograms_size_ = 0;
+	AllocateThreadBuffers();
 	
 	return true;
 }
 
-void MultiStepRefiner::SetData(const uint8* img_left, float32* cost,const CrossArm* cross_arms, float32* disp_left, float32* disp_right)
+void MultiStepRefiner::SetData(const uint8* img_left, const CostVolume* cost,const CrossArm* cross_arms, float32* disp_left, float32* disp_right)
 {
 	img_left_ = img_left;
 	cost_ = cost; 
@@ -45,6 +113,16 @@ void MultiStepRefiner::SetData(const uint8* img_left, float32* cost,const CrossA
 	disp_right_= disp_right;
 }
 
+void MultiStepRefiner::SetThreadPool(ThreadPool* thread_pool)
+{
+	thread_pool_ = thread_pool;
+}
+
+void MultiStepRefiner::SetArena(MemoryArena* arena)
+{
+	arena_ = arena;
+}
+
 void MultiStepRefiner::SetParam(const sint32& min_disparity, const sint32& max_disparity, const sint32& irv_ts, const float32& irv_th, const float32& lrcheck_thres,
 								const bool& do_lr_check, const bool& do_region_voting, const bool& do_interpolating, const bool& do_discontinuity_adjustment)
 {
@@ -67,10 +145,16 @@ void MultiStepRefiner::Refine()
 		return;
 	}
 
+	// the thread count or the disparity range may have changed since Initialize
+	AllocateThreadBuffers();
+
 	// step1: outlier detection
 	if (do_lr_check_) {
 		OutlierDetection();
 	}
+	else {
+		std::fill(outlier_label_, outlier_label_ + width_ * height_, static_cast<uint8>(OutlierNone));
+	}
 	// step2: iterative region voting
 	if (do_region_voting_) {
 		IterativeRegionVoting();
@@ -89,6 +173,25 @@ void MultiStepRefiner::Refine()
 }
 
 
+void MultiStepRefiner::AllocateThreadBuffers()
+{
+	const sint32 num_threads = thread_pool_ != nullptr ? thread_pool_->num_threads() : 1;
+	const sint32 disp_range = std::max(max_disparity_ - min_disparity_, 0);
+
+	// the write lists keep their capacity from frame to frame
+	vec_thread_writes_.resize(num_threads);
+	// a changed thread count or disparity range takes new buffers, the old ones of an arena stay until it is released
+	if (num_edge_row_threads_ != num_threads) {
+		edge_rows_ = AllocateBuffer(arena_, vec_edge_rows_, static_cast<size_t>(width_) * num_threads);
+		num_edge_row_threads_ = num_threads;
+	}
+	const size_t histograms_size = static_cast<size_t>(disp_range) * num_threads;
+	if (histograms_size_ != histograms_size) {
+		histograms_ = AllocateBuffer(arena_, vec_histograms_, histograms_size);
+		histograms_size_ = histograms_size;
+	}
+}
+
 void MultiStepRefiner::OutlierDetection()
 {
 	const sint32 width = width_;
@@ -96,65 +199,71 @@ void MultiStepRefiner::OutlierDetection()
 
 	const float32& threshold = lrcheck_thres_;
 
-	// �ڵ������غ���ƥ��������
-	auto& occlusions = occlusions_;
-	auto& mismatches = mismatches_;
-	occlusions.clear();
-	mismatches.clear();
-
+	// every row is checked by one thread, the class of every pixel goes to the label plane
 	// ---����һ���Լ��
-	for (sint32 y = 0; y < height; y++) {
-		for (sint32 x = 0; x < width; x++) {
-			// ��Ӱ���Ӳ�ֵ
-			auto& disp = disp_left_[y * width + x];
-			if (disp == Invalid_Float) {
-				mismatches.emplace_back(x, y);
-				continue;
-			}
+	ThreadPool::ParallelFor(thread_pool_, 0, height, [&](const sint32& y_begin, const sint32& y_end, const sint32&) {
+		for (sint32 y = y_begin; y < y_end; y++) {
+			for (sint32 x = 0; x < width; x++) {
+				auto& label = outlier_label_[y * width + x];
+				label = OutlierNone;
+				// ��Ӱ���Ӳ�ֵ
+				auto& disp = disp_left_[y * width + x];
+				if (disp == Invalid_Float) {
+					label = OutlierMismatch;
+					continue;
+				}
 
-			// �����Ӳ�ֵ�ҵ���Ӱ���϶�Ӧ��ͬ������
-			const auto col_right = lround(x - disp);
-			if (col_right >= 0 && col_right < width) {
-				// ��Ӱ����ͬ�����ص��Ӳ�ֵ
-				const auto& disp_r = disp_right_[y * width + col_right];
-				// �ж������Ӳ�ֵ�Ƿ�һ�£���ֵ����ֵ�ڣ�
-				if (abs(disp - disp_r) > threshold) {
-					// �����ڵ�������ƥ����
-					// ͨ����Ӱ���Ӳ��������Ӱ���ƥ�����أ�����ȡ�Ӳ�disp_rl
-					// if(disp_rl > disp) 
-					//		pixel in occlusions
-					// else 
-					//		pixel in mismatches
-					const sint32 col_rl = lround(col_right + disp_r);
-					if (col_rl > 0 && col_rl < width) {
-						const auto& disp_l = disp_left_[y * width + col_rl];
-						if (disp_l > disp) {
-							occlusions.emplace_back(x, y);
+				// �����Ӳ�ֵ�ҵ���Ӱ���϶�Ӧ��ͬ������
+				const auto col_right = lround(x - disp);
+				if (col_right >= 0 && col_right < width) {
+					// ��Ӱ����ͬ�����ص��Ӳ�ֵ
+					const auto& disp_r = disp_right_[y * width + col_right];
+					// �ж������Ӳ�ֵ�Ƿ�һ�£���ֵ����ֵ�ڣ�
+					// an invalid right disparity fails the check, it has no pixel in the left view to tell occlusions
+					if (disp_r == Invalid_Float) {
+						label = OutlierMismatch;
+						disp = Invalid_Float;
+					}
+					// compared in float
+					else if (std::abs(disp - disp_r) > threshold) {
+						// �����ڵ�������ƥ����
+						// ͨ����Ӱ���Ӳ��������Ӱ���ƥ�����أ�����ȡ�Ӳ�disp_rl
+						// if(disp_rl > disp) 
+						//		pixel in occlusions
+						// else 
+						//		pixel in mismatches
+						const sint32 col_rl = lround(col_right + disp_r);
+						if (col_rl > 0 && col_rl < width) {
+							const auto& disp_l = disp_left_[y * width + col_rl];
+							if (disp_l > disp) {
+								label = OutlierOcclusion;
+							}
+							else {
+								label = OutlierMismatch;
+							}
 						}
 						else {
-							mismatches.emplace_back(x, y);
+							label = OutlierMismatch;
 						}
-					}
-					else {
-						mismatches.emplace_back(x, y);
-					}
 
-					// ���Ӳ�ֵ��Ч
+						// ���Ӳ�ֵ��Ч
+						disp = Invalid_Float;
+					}
+				}
+				else {
+					// ͨ���Ӳ�ֵ����Ӱ�����Ҳ���ͬ�����أ�����Ӱ��Χ��
 					disp = Invalid_Float;
+					label = OutlierMismatch;
 				}
 			}
-			else {
-				// ͨ���Ӳ�ֵ����Ӱ�����Ҳ���ͬ�����أ�����Ӱ��Χ��
-				disp = Invalid_Float;
-				mismatches.emplace_back(x, y);
-			}
 		}
-	}
+	});
 }
 
 void MultiStepRefiner::IterativeRegionVoting()
 {
 	const sint32 width = width_;
+	const sint32 height = height_;
 
 	const auto disp_range = max_disparity_ - min_disparity_;
 	if(disp_range <= 0) {
@@ -162,67 +271,97 @@ void MultiStepRefiner::IterativeRegionVoting()
 	}
 	const auto arms = cross_arms_;
 
-	// ֱ��ͼ
-	vector<sint32> histogram(disp_range,0);
+	// one histogram and one list of votes per thread
+	sint32* histograms = histograms_;
+	auto& thread_votes = vec_thread_writes_;
 
 	// ����5��
 	const sint32 num_iters = 5;
 	
 	for (sint32 it = 0; it < num_iters; it++) {
 		for (sint32 k = 0; k < 2; k++) {
-			auto& trg_pixels = (k == 0) ? mismatches_ : occlusions_;
-			for (auto& pix : trg_pixels) {
-				const sint32& x = pix.first;
-				const sint32& y = pix.second;
-				auto& disp = disp_left_[y * width + x];
-				if(disp != Invalid_Float) {
-					continue;
-				}
+			// the targets are the pixels of the class that are still invalid
+			const uint8 target_label = (k == 0) ? OutlierMismatch : OutlierOcclusion;
+			for (auto& votes : thread_votes) {
+				votes.clear();
+			}
 
-				// init histogram
-				memset(&histogram[0], 0, disp_range * sizeof(sint32));
-
-				// ����֧�������Ӳ�ֱ��ͼ
-				// ��ȡarm
-				auto& arm = arms[y * width + x];
-				// ����֧���������Ӳͳ��ֱ��ͼ
-				for (sint32 t = -arm.top; t <= arm.bottom; t++) {
-					const sint32& yt = y + t;
-					auto& arm2 = arms[yt * width_ + x];
-					for (sint32 s = -arm2.left; s <= arm2.right; s++) {
-						const auto& d = disp_left_[yt * width + x + s];
-						if (d != Invalid_Float) {
-							const auto di = lround(d);
-							histogram[di - min_disparity_]++;
+			// the support region of (x,y) is the horizontal arms in column x of the rows [y - top, y + bottom],
+			// the targets of a column move a window of rows and add or remove whole row segments of a running histogram.
+			// the votes only read the disparities of the last sweep, the result does not depend on the threads
+			ThreadPool::ParallelFor(thread_pool_, 0, width, [&](const sint32& x_begin, const sint32& x_end, const sint32& thread_id) {
+				sint32* histogram = histograms + thread_id * disp_range;
+				auto& votes = thread_votes[thread_id];
+				for (sint32 x = x_begin; x < x_end; x++) {
+					// rows [row_begin, row_end) are in the histogram, its votes are in the bins [lo, hi]
+					sint32 row_begin = 0, row_end = 0, count = 0;
+					sint32 lo = disp_range, hi = -1;
+					const auto vote_row = [&](const sint32& yt, const sint32& step) {
+						auto& arm2 = arms[yt * width + x];
+						const float32* disp_row = disp_left_ + yt * width + x;
+						for (sint32 s = -arm2.left; s <= arm2.right; s++) {
+							const auto& d = disp_row[s];
+							if (d != Invalid_Float) {
+								const sint32 di = lround(d) - min_disparity_;
+								histogram[di] += step;
+								count += step;
+								lo = std::min(lo, di);
+								hi = std::max(hi, di);
+							}
+						}
+					};
+					const auto clear = [&]() {
+						if (lo <= hi) {
+							memset(histogram + lo, 0, (hi - lo + 1) * sizeof(sint32));
+						}
+						count = 0;
+						lo = disp_range;
+						hi = -1;
+					};
+
+					for (sint32 y = 0; y < height; y++) {
+						if (outlier_label_[y * width + x] != target_label || disp_left_[y * width + x] != Invalid_Float) {
+							continue;
+						}
+						auto& arm = arms[y * width + x];
+						const sint32 top = y - arm.top;
+						const sint32 bottom = y + arm.bottom + 1;
+
+						// move the window of rows to the support region
+						if (top >= row_end || bottom <= row_begin) {
+							clear();
+							row_begin = row_end = top;
+						}
+						while (row_end < bottom) { vote_row(row_end++, 1); }
+						while (row_begin > top) { vote_row(--row_begin, 1); }
+						while (row_end > bottom) { vote_row(--row_end, -1); }
+						while (row_begin < top) { vote_row(row_begin++, -1); }
+
+						// ����ֱ��ͼ��ֵ��Ӧ���Ӳ�
+						sint32 best_disp = 0, max_ht = 0;
+						for (sint32 d = lo; d <= hi; d++) {
+							const auto& h = histogram[d];
+							if (max_ht < h) {
+								max_ht = h;
+								best_disp = d;
+							}
 						}
-					}
-				}
-				// ����ֱ��ͼ��ֵ��Ӧ���Ӳ�
-				sint32 best_disp = 0, count = 0;
-				sint32 max_ht = 0;
-				for (sint32 d = 0; d < disp_range; d++) {
-					const auto& h = histogram[d];
-					if (max_ht < h) {
-						max_ht = h;
-						best_disp = d;
-					}
-					count += h;
-				}
 
-				if (max_ht > 0) {
-					if (count > irv_ts_ && max_ht * 1.0f / count > irv_th_) {
-						disp = best_disp + min_disparity_;
+						if (max_ht > 0) {
+							if (count > irv_ts_ && max_ht * 1.0f / count > irv_th_) {
+								votes.emplace_back(y * width + x, static_cast<float32>(best_disp + min_disparity_));
+							}
+						}
 					}
+					clear();
 				}
-			}
-			// ɾ�����������
-			for (auto it = trg_pixels.begin(); it != trg_pixels.end();) {
-				const sint32 x = it->first;
-				const sint32 y = it->second;
-				if(disp_left_[y * width + x]!=Invalid_Float) {
-					it = trg_pixels.erase(it);
+			});
+
+			// write the votes
+			for (auto& votes : thread_votes) {
+				for (auto& vote : votes) {
+					disp_left_[vote.first] = vote.second;
 				}
-				else { ++it; }
 			}
 		}
 	}
@@ -237,71 +376,105 @@ void MultiStepRefiner::ProperInterpolation()
 	// ��������г̣�û�б�Ҫ������Զ������
 	const sint32 max_search_length = std::max(abs(max_disparity_), abs(min_disparity_));
 
-	std::vector<pair<sint32, float32>> disp_collects;
+	// the 16 rays with angles s * pi / 16, step m of ray s is the pixel offset ray_steps[m * 16 + s]
+	const sint32 num_rays = 16;
+	auto& ray_steps = vec_ray_steps_;
+	ray_steps.resize(std::max(max_search_length, 1) * num_rays);
+	double ang = 0.0;
+	for (sint32 s = 0; s < num_rays; s++) {
+		const auto sina = sin(ang);
+		const auto cosa = cos(ang);
+		for (sint32 m = 1; m < max_search_length; m++) {
+			ray_steps[m * num_rays + s] = pair<sint32, sint32>(lround(m * cosa), lround(m * sina));
+		}
+		ang += pi / 16;
+	}
+
+	// the fill values of every thread, written after all of them are found
+	auto& thread_fills = vec_thread_writes_;
+
 	for (sint32 k = 0; k < 2; k++) {
-		auto& trg_pixels = (k == 0) ? mismatches_ : occlusions_;
-		if (trg_pixels.empty()) {
-			continue;
+		// the targets are the pixels of the class that are still invalid
+		const uint8 target_label = (k == 0) ? OutlierMismatch : OutlierOcclusion;
+		for (auto& fills : thread_fills) {
+			fills.clear();
 		}
-		std::vector<float32> fill_disps(trg_pixels.size());
 
 		// ��������������
-		for (auto n = 0u; n < trg_pixels.size(); n++) {
-			auto& pix = trg_pixels[n];
-			const sint32 x = pix.first;
-			const sint32 y = pix.second;
-
-			// �ռ�16���������������׸���Ч�Ӳ�ֵ
-			disp_collects.clear();
-			double ang = 0.0;
-			for (sint32 s = 0; s < 16; s++) {
-				const auto sina = sin(ang);
-				const auto cosa = cos(ang);
-				for (sint32 m = 1; m < max_search_length; m++) {
-					const sint32 yy = lround(y + m * sina);
-					const sint32 xx = lround(x + m * cosa);
-					if (yy < 0 || yy >= height || xx < 0 || xx >= width) { break;}
-					const auto& d = disp_left_[yy * width + xx];
-					if (d != Invalid_Float) {
-						disp_collects.emplace_back(yy * width * 3 + 3 * xx, d);
-						break;
+		// the fill values only read disp_left_, every pixel is independent
+		ThreadPool::ParallelFor(thread_pool_, 0, height, [&](const sint32& y_begin, const sint32& y_end, const sint32& thread_id) {
+			pair<sint32, float32> disp_collects[num_rays];
+			auto& fills = thread_fills[thread_id];
+			for (sint32 n = y_begin * width; n < y_end * width; n++) {
+				if (outlier_label_[n] != target_label || disp_left_[n] != Invalid_Float) {
+					continue;
+				}
+				const sint32 x = n % width;
+				const sint32 y = n / width;
+
+				// �ռ�16���������������׸���Ч�Ӳ�ֵ
+				sint32 num_collects = 0;
+				// the rays march together, a ray stops at its first valid disparity or at the border
+				sint32 ray_hits[num_rays];
+				uint32 active = (1u << num_rays) - 1;
+				for (sint32 m = 1; m < max_search_length && active != 0; m++) {
+					const auto* steps = &ray_steps[m * num_rays];
+					for (sint32 s = 0; s < num_rays; s++) {
+						if ((active & (1u << s)) == 0) {
+							continue;
+						}
+						const sint32 yy = y + steps[s].second;
+						const sint32 xx = x + steps[s].first;
+						if (yy < 0 || yy >= height || xx < 0 || xx >= width) {
+							ray_hits[s] = -1;
+							active &= ~(1u << s);
+						}
+						else if (disp_left_[yy * width + xx] != Invalid_Float) {
+							ray_hits[s] = yy * width + xx;
+							active &= ~(1u << s);
+						}
 					}
 				}
-				ang += pi / 16;
-			}
-			if (disp_collects.empty()) {
-				continue;
-			}
+				for (sint32 s = 0; s < num_rays; s++) {
+					if ((active & (1u << s)) == 0 && ray_hits[s] >= 0) {
+						disp_collects[num_collects++] = pair<sint32, float32>(ray_hits[s] * 3, disp_left_[ray_hits[s]]);
+					}
+				}
+				if (num_collects == 0) {
+					fills.emplace_back(n, 0.0f);
+					continue;
+				}
 
-			// �������ƥ��������ѡ����ɫ������������Ӳ�ֵ
-			// ������ڵ�������ѡ����С�Ӳ�ֵ
-			if (k == 0) {
-				sint32 min_dist = 9999;
-				float32 d = 0.0f;
-				const auto color = ADColor(img_left_[y*width * 3 + 3 * x], img_left_[y*width * 3 + 3 * x + 1], img_left_[y*width * 3 + 3 * x + 2]);
-				for (auto& dc : disp_collects) {
-					const auto color2 = ADColor(img_left_[dc.first], img_left_[dc.first + 1], img_left_[dc.first + 2]);
-					const auto dist = abs(color.r - color2.r) + abs(color.g - color2.g) + abs(color.b - color2.b);
-					if (min_dist > dist) {
-						min_dist = dist;
-						d = dc.second;
+				// �������ƥ��������ѡ����ɫ������������Ӳ�ֵ
+				// ������ڵ�������ѡ����С�Ӳ�ֵ
+				if (k == 0) {
+					sint32 min_dist = 9999;
+					float32 d = 0.0f;
+					const auto color = ADColor(img_left_[y*width * 3 + 3 * x], img_left_[y*width * 3 + 3 * x + 1], img_left_[y*width * 3 + 3 * x + 2]);
+					for (sint32 c = 0; c < num_collects; c++) {
+						const auto& dc = disp_collects[c];
+						const auto color2 = ADColor(img_left_[dc.first], img_left_[dc.first + 1], img_left_[dc.first + 2]);
+						const auto dist = abs(color.r - color2.r) + abs(color.g - color2.g) + abs(color.b - color2.b);
+						if (min_dist > dist) {
+							min_dist = dist;
+							d = dc.second;
+						}
 					}
+					fills.emplace_back(n, d);
 				}
-				fill_disps[n] = d;
-			}
-			else {
-				float32 min_disp = Large_Float;
-				for (auto& dc : disp_collects) {
-					min_disp = std::min(min_disp, dc.second);
+				else {
+					float32 min_disp = Large_Float;
+					for (sint32 c = 0; c < num_collects; c++) {
+						min_disp = std::min(min_disp, disp_collects[c].second);
+					}
+					fills.emplace_back(n, min_disp);
 				}
-				fill_disps[n] = min_disp;
 			}
-		}
-		for (auto n = 0u; n < trg_pixels.size(); n++) {
-			auto& pix = trg_pixels[n];
-			const sint32 x = pix.first;
-			const sint32 y = pix.second;
-			disp_left_[y * width + x] = fill_disps[n];
+		});
+		for (auto& fills : thread_fills) {
+			for (auto& fill : fills) {
+				disp_left_[fill.first] = fill.second;
+			}
 		}
 	}
 }
@@ -318,56 +491,60 @@ void MultiStepRefiner::DepthDiscontinuityAdjustment()
 	// ���Ӳ�ͼ����Ե���
 	// ��Ե���ķ��������ģ�����ѡ��sobel����
 	const float32 edge_thres = 5.0f;
-	EdgeDetect(&vec_edge_left_[0], disp_left_, width, height, edge_thres);
+	const EdgeRowFunc edge_row = SelectEdgeRowFunc();
+
+	// the edge test and the adjustment of a row only read disp_left_, the adjusted disparities of every thread are
+	// written after all rows, so the result does not depend on the order of the pixels
+	auto& thread_adjusts = vec_thread_writes_;
+	for (auto& adjusts : thread_adjusts) {
+		adjusts.clear();
+	}
 
 	// ������Ե���ص��Ӳ�
-	for (sint32 y = 0; y < height; y++) {
-		for (sint32 x = 1; x < width - 1; x++) {
-			const auto& e_label = vec_edge_left_[y*width + x];
-			if (e_label == 1) {
-				const auto disp_ptr = disp_left_ + y*width;
-				float32& d = disp_ptr[x];
-				if (d != Invalid_Float) {
-					const sint32& di = lround(d);
-					const auto cost_ptr = cost_ + y*width*disp_range + x*disp_range;
-					float32 c0 = cost_ptr[di];
-
-					// ��¼�����������ص��Ӳ�ֵ�ʹ���ֵ
-					// ѡ�������С�������Ӳ�ֵ
-					for (int k = 0; k<2; k++) {
-						const sint32 x2 = (k == 0) ? x - 1 : x + 1;
-						const float32& d2 = disp_ptr[x2];
-						const sint32& d2i = lround(d2);
-						if (d2 != Invalid_Float) {
-							const auto& c = (k == 0) ? cost_ptr[-disp_range + d2i] : cost_ptr[disp_range + d2i];
-							if (c < c0) {
-								d = d2;
-								c0 = c;
-							}
+	ThreadPool::ParallelFor(thread_pool_, 1, height - 1, [&](const sint32& y_begin, const sint32& y_end, const sint32& thread_id) {
+		uint8* edges = edge_rows_ + thread_id * width;
+		auto& adjusts = thread_adjusts[thread_id];
+		for (sint32 y = y_begin; y < y_end; y++) {
+			const auto disp_ptr = disp_left_ + y*width;
+			if (width > 2) {
+				edge_row(disp_ptr - width + 1, disp_ptr + 1, disp_ptr + width + 1, &edges[1], width - 2, edge_thres);
+			}
+			for (sint32 x = 1; x < width - 1; x++) {
+				if (edges[x] == 0) {
+					continue;
+				}
+				const float32& d = disp_ptr[x];
+				if (d == Invalid_Float) {
+					continue;
+				}
+				const sint32& di = lround(d);
+				const sint32 cost_base = y*width*disp_range + x*disp_range;
+				float32 c0 = cost_->Get(cost_base + di);
+				float32 d_adjust = d;
+
+				// ��¼�����������ص��Ӳ�ֵ�ʹ���ֵ
+				// ѡ�������С�������Ӳ�ֵ
+				for (int k = 0; k<2; k++) {
+					const sint32 x2 = (k == 0) ? x - 1 : x + 1;
+					const float32& d2 = disp_ptr[x2];
+					const sint32& d2i = lround(d2);
+					if (d2 != Invalid_Float) {
+						const float32 c = (k == 0) ? cost_->Get(cost_base - disp_range + d2i) : cost_->Get(cost_base + disp_range + d2i);
+						if (c < c0) {
+							d_adjust = d2;
+							c0 = c;
 						}
 					}
 				}
+				if (d_adjust != d) {
+					adjusts.emplace_back(y * width + x, d_adjust);
+				}
 			}
 		}
-	}
-	
-}
-
-void MultiStepRefiner::EdgeDetect(uint8* edge_mask, const float32* disp_ptr, const sint32& width, const sint32& height, const float32 threshold)
-{
-	memset(edge_mask, 0, width*height * sizeof(uint8));
-	// sobel����
-	for (int y = 1; y < height - 1; y++) {
-		for (int x = 1; x < width - 1; x++) {
-			const auto grad_x = (-disp_ptr[(y - 1) * width + x - 1] + disp_ptr[(y - 1) * width + x + 1]) +
-				(-2 * disp_ptr[y * width + x - 1] + 2 * disp_ptr[y * width + x + 1]) +
-				(-disp_ptr[(y + 1) * width + x - 1] + disp_ptr[(y + 1) * width + x + 1]);
-			const auto grad_y = (-disp_ptr[(y - 1) * width + x - 1] - 2 * disp_ptr[(y - 1) * width + x] - disp_ptr[(y - 1) * width + x + 1]) +
-				(disp_ptr[(y + 1) * width + x - 1] + 2 * disp_ptr[(y + 1) * width + x] + disp_ptr[(y + 1) * width + x + 1]);
-			const auto grad = abs(grad_x) + abs(grad_y);
-			if (grad > threshold) {
-				edge_mask[y*width + x] = 1;
-			}
+	});
+	for (auto& adjusts : thread_adjusts) {
+		for (auto& adjust : adjusts) {
+			disp_left_[adjust.first] = adjust.second;
 		}
 	}
 }
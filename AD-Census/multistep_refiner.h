@@ -8,7 +8,10 @@
 #define AD_CENSUS_MULTISTEP_REFINER_H_
 
 #include "adcensus_types.h"
+#include "cost_volume.h"
+#include "thread_pool.h"
 #include "cross_aggregator.h"
+#include "memory_arena.h"
 
 class MultiStepRefiner
 {
@@ -32,9 +35,24 @@ public:
 	 * \param disp_left			// ͼӲ
 	 * \param disp_right		// ͼӲ
 	 */
-	void SetData(const uint8* img_left, float32* cost,const CrossArm* cross_arms, float32* disp_left, float32* disp_right);
+	void SetData(const uint8* img_left, const CostVolume* cost,const CrossArm* cross_arms, float32* disp_left, float32* disp_right);
 
 
+	/**
+	 * \brief set the thread pool the refinement runs on
+	 * The left-right check, the interpolation and the discontinuity adjustment are split by rows, the region voting by columns.
+	 * \param thread_pool	thread pool, nullptr: run on the calling thread
+	 */
+	void SetThreadPool(ThreadPool* thread_pool);
+
+	/**
+	 * \brief set the arena the label plane and the per thread buffers are taken from, before Initialize
+	 * The per thread buffers are taken again if the thread count or the disparity range changes, the histograms on the first Refine.
+	 * The write lists of the threads grow with the pixels they change and keep their own storage.
+	 * \param arena		memory arena, nullptr: the buffers allocate their own storage
+	 */
+	void SetArena(MemoryArena* arena);
+
 	/**
 	 * \brief öಽŻĲ
 	 * \param min_disparity					// СӲ
@@ -64,8 +82,12 @@ private:
 	/** \brief ȷӲ */
 	void DepthDiscontinuityAdjustment();
 
-	/** \brief ӲͼԵ	 */
-	static void EdgeDetect(uint8* edge_mask, const float32* disp_ptr,const sint32& width,const sint32& height, const float32 threshold);
+	/** \brief size the per thread buffers for the thread count and the disparity range, a no-op when neither changed */
+	void AllocateThreadBuffers();
+
+	/** \brief outlier classes of the label plane */
+	enum OutlierLabel : uint8 { OutlierNone = 0, OutlierMismatch, OutlierOcclusion };
+
 private:
 	/** \brief ͼߴ */
 	sint32	width_;
@@ -75,17 +97,19 @@ private:
 	const uint8* img_left_;
 	
 	/** \brief  */
-	float32* cost_;
+	const CostVolume* cost_;
 	/** \brief  */
 	const CrossArm* cross_arms_;
 
+	/** \brief thread pool, nullptr: single threaded */
+	ThreadPool* thread_pool_;
+	/** \brief arena of the label plane and the per thread buffers, nullptr: own storage */
+	MemoryArena* arena_;
+
 	/** \brief ͼӲ */
 	float* disp_left_;
 	/** \brief ͼӲ */
 	float* disp_right_;
-
-	/** \brief ͼԵ */
-	vector<uint8> vec_edge_left_;
 	
 	/** \brief СӲֵ */
 	sint32 min_disparity_;
@@ -109,9 +133,24 @@ private:
 	/** \brief Ƿ */
 	bool	do_discontinuity_adjustment_;
 	
-	/** \brief ڵؼ	*/
-	vector<pair<int, int>> occlusions_;
-	/** \brief ƥؼ	*/
-	vector<pair<int, int>> mismatches_;
+	/** \brief outlier class of every pixel, set by the left-right check */
+	uint8* outlier_label_;
+
+	/** \brief disparity writes of every thread, applied after each pass of the voting, the interpolation and the adjustment */
+	vector<vector<pair<sint32, float32>>> vec_thread_writes_;
+	/** \brief vote histogram of every thread for the region voting, disparity range bins each, kept zeroed */
+	sint32* histograms_;
+	/** \brief row of edge flags of every thread for the discontinuity adjustment */
+	uint8* edge_rows_;
+	/** \brief thread count of edge_rows_ and elements of histograms_, 0: not allocated */
+	sint32 num_edge_row_threads_;
+	size_t histograms_size_;
+
+	/** \brief storage of the buffers above without an arena */
+	vector<uint8> vec_outlier_label_;
+	vector<sint32> vec_histograms_;
+	vector<uint8> vec_edge_rows_;
+	/** \brief pixel offsets of the 16 rays of the interpolation */
+	vector<pair<sint32, sint32>> vec_ray_steps_;
 };
 #endif
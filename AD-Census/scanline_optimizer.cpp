@@ -5,20 +5,307 @@
 */
 
 #include "scanline_optimizer.h"
+#include "adcensus_simd.h"
+#include "adcensus_util.h"
 
 #include <cassert>
 #include <cstring>
 
+namespace
+{
+	/** \brief step (dx, dy) of a forward path from the predecessor of a pixel to the pixel */
+	struct PathOrientation {
+		sint32 dx, dy;
+	};
+	/** \brief left/right and up/down for 4 paths, the diagonals for 8 paths, the knight moves for 16 paths */
+	const PathOrientation kPathOrientations[8] = {
+		{ 1, 0 }, { 0, 1 },
+		{ 1, 1 }, { -1, 1 },
+		{ 2, 1 }, { -2, 1 }, { 1, 2 }, { -1, 2 }
+	};
+
+	/** \brief a / b rounded down, b > 0 */
+	inline sint32 FloorDiv(const sint32& a, const sint32& b)
+	{
+		return a >= 0 ? a / b : -((b - 1 - a) / b);
+	}
+
+	/**
+	 * \brief one step of a scanline path over n disparities
+	 * cur[d + 1] = (cost[d] + min(last[d + 1], last[d] + P1, last[d + 2] + P1, min_last + P2)) / 2,
+	 * P1 and P2 of disparity d are p1_lut[codes[d]] and p2_lut[codes[d]], codes in [0,8)
+	 * \return min(Large_Float, cur[1..n])
+	 */
+	typedef float32(*PathStepFunc)(const float32* cost, const float32* last, float32* cur, const uint8* codes, const sint32& n,
+		const float32* p1_lut, const float32* p2_lut, const float32& min_last);
+
+	float32 PathStepScalar(const float32* cost, const float32* last, float32* cur, const uint8* codes, const sint32& n,
+		const float32* p1_lut, const float32* p2_lut, const float32& min_last)
+	{
+		float32 min_cost = Large_Float;
+		for (sint32 d = 0; d < n; d++) {
+			const float32 P1 = p1_lut[codes[d]];
+			const float32 P2 = p2_lut[codes[d]];
+			const float32 l1 = last[d + 1];
+			const float32 l2 = last[d] + P1;
+			const float32 l3 = last[d + 2] + P1;
+			const float32 l4 = min_last + P2;
+			float32 cost_s = cost[d] + std::min(std::min(l1, l2), std::min(l3, l4));
+			cost_s /= 2;
+			cur[d + 1] = cost_s;
+			min_cost = std::min(min_cost, cost_s);
+		}
+		return min_cost;
+	}
+
+#if defined(ADCENSUS_X86)
+	/** \brief min of the 8 lanes */
+	ADCENSUS_TARGET_AVX2
+	inline float32 HorizontalMinAvx2(const __m256& v)
+	{
+		__m128 m = _mm_min_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+		m = _mm_min_ps(m, _mm_movehl_ps(m, m));
+		m = _mm_min_ss(m, _mm_shuffle_ps(m, m, 1));
+		return _mm_cvtss_f32(m);
+	}
+
+	/** \brief 8 disparities per iteration, the penalties are looked up with a register permute */
+	ADCENSUS_TARGET_AVX2
+	float32 PathStepAvx2(const float32* cost, const float32* last, float32* cur, const uint8* codes, const sint32& n,
+		const float32* p1_lut, const float32* p2_lut, const float32& min_last)
+	{
+		const __m256 p1 = _mm256_loadu_ps(p1_lut);
+		const __m256 p2 = _mm256_loadu_ps(p2_lut);
+		const __m256 min_l = _mm256_set1_ps(min_last);
+		const __m256 half = _mm256_set1_ps(0.5f);
+		__m256 min_cost = _mm256_set1_ps(Large_Float);
+		sint32 d = 0;
+		for (; d + 8 <= n; d += 8) {
+			const __m256i f = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(codes + d)));
+			const __m256 P1 = _mm256_permutevar8x32_ps(p1, f);
+			const __m256 P2 = _mm256_permutevar8x32_ps(p2, f);
+			const __m256 l1 = _mm256_loadu_ps(last + d + 1);
+			const __m256 l2 = _mm256_add_ps(_mm256_loadu_ps(last + d), P1);
+			const __m256 l3 = _mm256_add_ps(_mm256_loadu_ps(last + d + 2), P1);
+			const __m256 l4 = _mm256_add_ps(min_l, P2);
+			const __m256 l = _mm256_min_ps(_mm256_min_ps(l1, l2), _mm256_min_ps(l3, l4));
+			// x * 0.5 is exactly x / 2
+			const __m256 cost_s = _mm256_mul_ps(_mm256_add_ps(_mm256_loadu_ps(cost + d), l), half);
+			_mm256_storeu_ps(cur + d + 1, cost_s);
+			min_cost = _mm256_min_ps(min_cost, cost_s);
+		}
+		const float32 min_tail = PathStepScalar(cost + d, last + d, cur + d, codes + d, n - d, p1_lut, p2_lut, min_last);
+		return std::min(HorizontalMinAvx2(min_cost), min_tail);
+	}
+#endif
+
+	/** \brief the best kernel the cpu supports */
+	PathStepFunc SelectPathStepFunc()
+	{
+#if defined(ADCENSUS_X86)
+		const auto& cpu = adcensus_simd::GetCpuFeatures();
+		if (cpu.avx2) {
+			return PathStepAvx2;
+		}
+#endif
+		return PathStepScalar;
+	}
+
+	/**
+	 * \brief one step of a fixed point scanline path, costs at the scale of CostTraits<uint16>
+	 * cur[d + 1] = sat(cost[d] + min(last[d + 1], sat(last[d] + P1), sat(last[d + 2] + P1), sat(min_last + P2))) >> 1,
+	 * sat() saturates at 65535, P1 and P2 as in PathStepFunc
+	 * \return min(65535, cur[1..n])
+	 */
+	typedef uint16(*PathStepFixedFunc)(const uint16* cost, const uint16* last, uint16* cur, const uint8* codes, const sint32& n,
+		const uint16* p1_lut, const uint16* p2_lut, const uint16& min_last);
+
+	/** \brief a + b saturated at 65535 */
+	inline uint16 AddSat(const uint16& a, const uint16& b)
+	{
+		const uint32 sum = static_cast<uint32>(a) + b;
+		return sum > 65535 ? 65535 : static_cast<uint16>(sum);
+	}
+
+	uint16 PathStepFixedScalar(const uint16* cost, const uint16* last, uint16* cur, const uint8* codes, const sint32& n,
+		const uint16* p1_lut, const uint16* p2_lut, const uint16& min_last)
+	{
+		uint16 min_cost = 65535;
+		for (sint32 d = 0; d < n; d++) {
+			const uint16 P1 = p1_lut[codes[d]];
+			const uint16 P2 = p2_lut[codes[d]];
+			const uint16 l1 = last[d + 1];
+			const uint16 l2 = AddSat(last[d], P1);
+			const uint16 l3 = AddSat(last[d + 2], P1);
+			const uint16 l4 = AddSat(min_last, P2);
+			const uint16 cost_s = AddSat(cost[d], std::min(std::min(l1, l2), std::min(l3, l4))) >> 1;
+			cur[d + 1] = cost_s;
+			min_cost = std::min(min_cost, cost_s);
+		}
+		return min_cost;
+	}
+
+#if defined(ADCENSUS_X86)
+	/** \brief min of the 16 lanes */
+	ADCENSUS_TARGET_AVX2
+	inline uint16 HorizontalMinEpu16Avx2(const __m256i& v)
+	{
+		const __m128i m = _mm_min_epu16(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+		return static_cast<uint16>(_mm_cvtsi128_si32(_mm_minpos_epu16(m)));
+	}
+
+	/** \brief 16 disparities per iteration, the penalties are looked up with a byte shuffle */
+	ADCENSUS_TARGET_AVX2
+	uint16 PathStepFixedAvx2(const uint16* cost, const uint16* last, uint16* cur, const uint8* codes, const sint32& n,
+		const uint16* p1_lut, const uint16* p2_lut, const uint16& min_last)
+	{
+		// the 8 entries of a lut in both 128 bit lanes, entry c is the bytes 2c and 2c + 1
+		const __m256i p1 = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p1_lut)));
+		const __m256i p2 = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p2_lut)));
+		const __m256i index_mul = _mm256_set1_epi16(0x0202);
+		const __m256i index_add = _mm256_set1_epi16(0x0100);
+		const __m256i min_l = _mm256_set1_epi16(static_cast<sint16>(min_last));
+		__m256i min_cost = _mm256_set1_epi16(-1);
+		sint32 d = 0;
+		for (; d + 16 <= n; d += 16) {
+			const __m256i c = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(codes + d)));
+			const __m256i index = _mm256_add_epi16(_mm256_mullo_epi16(c, index_mul), index_add);
+			const __m256i P1 = _mm256_shuffle_epi8(p1, index);
+			const __m256i P2 = _mm256_shuffle_epi8(p2, index);
+			const __m256i l1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(last + d + 1));
+			const __m256i l2 = _mm256_adds_epu16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(last + d)), P1);
+			const __m256i l3 = _mm256_adds_epu16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(last + d + 2)), P1);
+			const __m256i l4 = _mm256_adds_epu16(min_l, P2);
+			const __m256i l = _mm256_min_epu16(_mm256_min_epu16(l1, l2), _mm256_min_epu16(l3, l4));
+			const __m256i cost_s = _mm256_srli_epi16(_mm256_adds_epu16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(cost + d)), l), 1);
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(cur + d + 1), cost_s);
+			min_cost = _mm256_min_epu16(min_cost, cost_s);
+		}
+		const uint16 min_tail = PathStepFixedScalar(cost + d, last + d, cur + d, codes + d, n - d, p1_lut, p2_lut, min_last);
+		return std::min(HorizontalMinEpu16Avx2(min_cost), min_tail);
+	}
+#endif
+
+	/** \brief the best fixed point kernel the cpu supports */
+	PathStepFixedFunc SelectPathStepFixedFunc()
+	{
+#if defined(ADCENSUS_X86)
+		const auto& cpu = adcensus_simd::GetCpuFeatures();
+		if (cpu.avx2) {
+			return PathStepFixedAvx2;
+		}
+#endif
+		return PathStepFixedScalar;
+	}
+
+	/**
+	 * \brief path cost type P of the recurrence: float32, or uint16 fixed point at the scale of CostTraits<uint16>
+	 * Load/Store convert between the stored costs of type T and the path costs.
+	 */
+	template<typename P> struct PathTraits;
+
+	template<> struct PathTraits<float32> {
+		typedef PathStepFunc StepFunc;
+		static float32 Large() { return Large_Float; }
+		static float32 Penalty(const float32& p) { return p; }
+		static StepFunc SelectStepFunc() { return SelectPathStepFunc(); }
+		template<typename T> static float32 Load(const T& v) { return CostTraits<T>::Load(v); }
+		template<typename T> static T Store(const float32& v) { return CostTraits<T>::Store(v); }
+	};
+
+	template<> struct PathTraits<uint16> {
+		typedef PathStepFixedFunc StepFunc;
+		static uint16 Large() { return 65535; }
+		static uint16 Penalty(const float32& p) { return CostTraits<uint16>::Store(p); }
+		static StepFunc SelectStepFunc() { return SelectPathStepFixedFunc(); }
+		template<typename T> static uint16 Load(const T& v) { return CostTraits<uint16>::Store(CostTraits<T>::Load(v)); }
+		template<typename T> static T Store(const uint16& v) { return CostTraits<T>::Store(CostTraits<uint16>::Load(v)); }
+	};
+
+	/** \brief path costs of one pixel, a volume that stores the path cost type is used directly */
+	template<typename P, typename T>
+	const P* LoadCosts(const T* src, P* buffer, const sint32& n)
+	{
+		for (sint32 d = 0; d < n; d++) {
+			buffer[d] = PathTraits<P>::Load(src[d]);
+		}
+		return buffer;
+	}
+	inline const float32* LoadCosts(const float32* src, float32*, const sint32&)
+	{
+		return src;
+	}
+	inline const uint16* LoadCosts(const uint16* src, uint16*, const sint32&)
+	{
+		return src;
+	}
+
+	/** \brief store the path costs of one pixel */
+	template<typename P, typename T>
+	void StoreCosts(const P* src, T* dst, const sint32& n)
+	{
+		for (sint32 d = 0; d < n; d++) {
+			dst[d] = PathTraits<P>::template Store<T>(src[d]);
+		}
+	}
+	inline void StoreCosts(const uint16* src, uint16* dst, const sint32& n)
+	{
+		memcpy(dst, src, n * sizeof(uint16));
+	}
+
+	/** \brief acc_weight * acc + path_weight * path of one pixel as float32, rounded as if stored to and loaded from a volume of type T */
+	template<typename T, typename P>
+	void BlendRowCosts(const P* path, const T* acc, const float32& acc_weight, const float32& path_weight, float32* dst, const sint32& n)
+	{
+		for (sint32 d = 0; d < n; d++) {
+			const float32 v = acc_weight * CostTraits<T>::Load(acc[d]) + path_weight * PathTraits<P>::template Store<float32>(path[d]);
+			dst[d] = CostTraits<T>::Load(CostTraits<T>::Store(v));
+		}
+	}
+
+	/** \brief acc_weight * acc + path_weight * path of one pixel, stored to a volume of type T, dst may be acc */
+	template<typename T, typename P>
+	void BlendCosts(const P* path, const T* acc, const float32& acc_weight, const float32& path_weight, T* dst, const sint32& n)
+	{
+		for (sint32 d = 0; d < n; d++) {
+			dst[d] = CostTraits<T>::Store(acc_weight * CostTraits<T>::Load(acc[d]) + path_weight * PathTraits<P>::template Store<float32>(path[d]));
+		}
+	}
+
+	/** \brief path costs of one pixel as float32, rounded as if stored to and loaded from a volume of type T */
+	template<typename T, typename P>
+	void StoreRowCosts(const P* src, float32* dst, const sint32& n)
+	{
+		for (sint32 d = 0; d < n; d++) {
+			dst[d] = CostTraits<T>::Load(PathTraits<P>::template Store<T>(src[d]));
+		}
+	}
+}
+
 ScanlineOptimizer::ScanlineOptimizer(): width_(0), height_(0), img_left_(nullptr), img_right_(nullptr),
-                                        cost_init_(nullptr), cost_aggr_(nullptr),
+                                        cost_init_(nullptr), cost_aggr_(nullptr), thread_pool_(nullptr),
+                                        path_strip_width_(0), disp_left_(nullptr), disp_right_(nullptr),
+                                        confidence_(nullptr), confidence_measure_(ConfidencePeakRatio),
                                         min_disparity_(0), max_disparity_(0),
                                         so_p1_(0), so_p2_(0),
-                                        so_tso_(0) {}
+                                        so_tso_(0), so_num_paths_(4), so_fixed_point_(false) {}
 
 ScanlineOptimizer::~ScanlineOptimizer() {}
 
-void ScanlineOptimizer::SetData(const uint8* img_left, const uint8* img_right, float32* cost_init,
-	float32* cost_aggr)
+template<>
+float32* ScanlineOptimizer::path_buffer<float32>(const sint32& k, const sint32& thread_id)
+{
+	return &vec_path_float_[k][thread_id * path_buffer_size(k)];
+}
+
+template<>
+uint16* ScanlineOptimizer::path_buffer<uint16>(const sint32& k, const sint32& thread_id)
+{
+	return &vec_path_fixed_[k][thread_id * path_buffer_size(k)];
+}
+
+void ScanlineOptimizer::SetData(const uint8* img_left, const uint8* img_right, CostVolume* cost_init,
+	CostVolume* cost_aggr)
 {
 	img_left_ = img_left;
 	img_right_ = img_right;
@@ -26,8 +313,23 @@ void ScanlineOptimizer::SetData(const uint8* img_left, const uint8* img_right, f
 	cost_aggr_ = cost_aggr;
 }
 
+void ScanlineOptimizer::SetThreadPool(ThreadPool* thread_pool)
+{
+	thread_pool_ = thread_pool;
+}
+
+void ScanlineOptimizer::SetDisparityOutput(float32* disp_left, float32* disp_right, float32* confidence,
+	const ConfidenceMeasure& measure)
+{
+	disp_left_ = disp_left;
+	disp_right_ = disp_right;
+	confidence_ = confidence;
+	confidence_measure_ = measure;
+}
+
 void ScanlineOptimizer::SetParam(const sint32& width, const sint32& height, const sint32& min_disparity,
-	const sint32& max_disparity, const float32& p1, const float32& p2, const sint32& tso)
+	const sint32& max_disparity, const float32& p1, const float32& p2, const sint32& tso, const sint32& num_paths,
+	const bool& fixed_point)
 {
 	width_ = width;
 	height_ = height;
@@ -36,6 +338,8 @@ void ScanlineOptimizer::SetParam(const sint32& width, const sint32& height, cons
 	so_p1_ = p1;
 	so_p2_ = p2;
 	so_tso_ = tso;
+	so_num_paths_ = num_paths;
+	so_fixed_point_ = fixed_point;
 }
 
 void ScanlineOptimizer::Optimize()
@@ -45,31 +349,84 @@ void ScanlineOptimizer::Optimize()
 		cost_init_ == nullptr || cost_aggr_ == nullptr) {
 		return;
 	}
-	
+	if (cost_init_->type() != cost_aggr_->type() || cost_init_->size() != cost_aggr_->size()) {
+		return;
+	}
+	if (so_num_paths_ != 4 && so_num_paths_ != 8 && so_num_paths_ != 16) {
+		return;
+	}
+	if (disp_left_ == nullptr && (disp_right_ != nullptr || confidence_ != nullptr)) {
+		return;
+	}
+
+	// color step maps of both images, shared by the forward and backward passes
+	BuildPenaltyMaps();
+	// the buffers of the paths, reused by all passes
+	AllocatePathBuffers();
+
+	switch (cost_aggr_->type()) {
+	case CostUInt16:
+		Optimize(cost_init_->ptr<uint16>(), cost_aggr_->ptr<uint16>());
+		break;
+	case CostUInt8:
+		Optimize(cost_init_->ptr<uint8>(), cost_aggr_->ptr<uint8>());
+		break;
+	default:
+		Optimize(cost_init_->ptr<float32>(), cost_aggr_->ptr<float32>());
+		break;
+	}
+}
+
+template<typename T>
+void ScanlineOptimizer::Optimize(T* cost_init, T* cost_aggr)
+{
+	if (so_fixed_point_) {
+		Optimize<T, uint16>(cost_init, cost_aggr);
+	}
+	else {
+		Optimize<T, float32>(cost_init, cost_aggr);
+	}
+}
+
+template<typename T, typename P>
+void ScanlineOptimizer::Optimize(T* cost_init, T* cost_aggr)
+{
 	// 4����ɨ�����Ż�
 	// ģ����״���������һ�����۾ۺϺ�����ݣ�Ҳ����cost_aggr_
 	// ���ǰ��ĸ�������Ż���������У�������cost_init_��cost_aggr_��α�����ʱ���ݣ��������ÿ��ٶ�����ڴ����洢�м���
 	// ģ����������Ҳ��cost_aggr_
 	
 	// left to right
-	ScanlineOptimizeLeftRight(cost_aggr_, cost_init_, true);
+	ScanlineOptimizeLeftRight<T, P>(cost_aggr, cost_init, true);
 	// right to left
-	ScanlineOptimizeLeftRight(cost_init_, cost_aggr_, false);
-	// up to down
-	ScanlineOptimizeUpDown(cost_aggr_, cost_init_, true);
-	// down to up
-	ScanlineOptimizeUpDown(cost_init_, cost_aggr_, false);
+	ScanlineOptimizeLeftRight<T, P>(cost_init, cost_aggr, false);
+	// up to down, down to up, the last pass computes the disparities of the 4 path mode if there is a disparity output
+	const sint32 num_orientations = so_num_paths_ / 2;
+	ScanlineOptimizeRows<T, P>(cost_aggr, cost_init, 1, true);
+	ScanlineOptimizeRows<T, P>(cost_init, cost_aggr, 1, false, disp_left_ != nullptr && num_orientations == 2);
+
+	// the diagonals of the 8 and 16 path modes each optimize the 4 path result in cost_aggr, which is averaged with them.
+	// cost_init keeps the running sum, the last pass writes the average to cost_aggr (every pixel is read before it is written)
+	// or computes the disparities from it
+	const sint32 num_passes = 2 * (num_orientations - 2);
+	const float32 weight = 1.0f / (num_passes + 1);
+	for (sint32 pass = 0; pass < num_passes; pass++) {
+		const sint32 orientation = 2 + pass / 2;
+		const bool is_forward = (pass % 2) == 0;
+		const bool last = pass == num_passes - 1;
+		const T* cost_acc = pass == 0 ? cost_aggr : cost_init;
+		ScanlineOptimizeRows<T, P>(cost_aggr, last ? cost_aggr : cost_init, orientation, is_forward, last && disp_left_ != nullptr,
+			cost_acc, pass == 0 ? weight : 1.0f, weight);
+	}
 }
 
-void ScanlineOptimizer::ScanlineOptimizeLeftRight(const float32* cost_so_src, float32* cost_so_dst, bool is_forward)
+template<typename T, typename P>
+void ScanlineOptimizer::ScanlineOptimizeLeftRight(const T* cost_so_src, T* cost_so_dst, bool is_forward)
 {
 	const auto width = width_;
 	const auto height = height_;
 	const auto min_disparity = min_disparity_;
 	const auto max_disparity = max_disparity_;
-	const auto p1 = so_p1_;
-	const auto p2 = so_p2_;
-	const auto tso = so_tso_;
 	
 	assert(width > 0 && height > 0 && max_disparity > min_disparity);
 
@@ -80,201 +437,393 @@ void ScanlineOptimizer::ScanlineOptimizeLeftRight(const float32* cost_so_src, fl
 	// ����(��->��) ��is_forward = false; direction = -1;
 	const sint32 direction = is_forward ? 1 : -1;
 
-	// �ۺ�
-	for (sint32 y = 0u; y < height; y++) {
-		// ·��ͷΪÿһ�е���(β,dir=-1)������
-		auto cost_init_row = (is_forward) ? (cost_so_src + y * width * disp_range) : (cost_so_src + y * width * disp_range + (width - 1) * disp_range);
-		auto cost_aggr_row = (is_forward) ? (cost_so_dst + y * width * disp_range) : (cost_so_dst + y * width * disp_range + (width - 1) * disp_range);
-		auto img_row = (is_forward) ? (img_left_ + y * width * 3) : (img_left_ + y * width * 3 + 3 * (width - 1));
-		const auto img_row_r = img_right_ + y * width * 3;
-		sint32 x = (is_forward) ? 0 : width - 1;
-
-		// ·���ϵ�ǰ��ɫֵ����һ����ɫֵ
-		ADColor color(img_row[0], img_row[1], img_row[2]);
-		ADColor color_last = color;
+	// the left color step of pixel x is at x (forward) or x + 1 (backward) in the step map
+	const uint8* left_steps = &vec_left_steps_[0][is_forward ? 0 : 1];
+	const sint32 codes_stride = width + disp_range;
+	const typename PathTraits<P>::StepFunc path_step = PathTraits<P>::SelectStepFunc();
 
+	// �ۺ�
+	// the rows are independent paths
+	ThreadPool::ParallelFor(thread_pool_, 0, height, [&](const sint32& y_begin, const sint32& y_end, const sint32& thread_id) {
 		// ·�����ϸ����صĴ������飬������Ԫ����Ϊ�˱���߽��������β����һ����
-		std::vector<float32> cost_last_path(disp_range + 2, Large_Float);
-
-		// ��ʼ������һ�����صľۺϴ���ֵ���ڳ�ʼ����ֵ
-		memcpy(cost_aggr_row, cost_init_row, disp_range * sizeof(float32));
-		memcpy(&cost_last_path[1], cost_aggr_row, disp_range * sizeof(float32));
-		cost_init_row += direction * disp_range;
-		cost_aggr_row += direction * disp_range;
-		img_row += direction * 3;
-		x += direction;
-
-		// ·�����ϸ����ص���С����ֵ
-		float32 mincost_last_path = Large_Float;
-		for (auto cost : cost_last_path) {
-			mincost_last_path = std::min(mincost_last_path, cost);
-		}
-
-		// �Է����ϵ�2�����ؿ�ʼ��˳��ۺ�
-		for (sint32 j = 0; j < width - 1; j++) {
-			color = ADColor(img_row[0], img_row[1], img_row[2]);
-			const uint8 d1 = ColorDist(color, color_last);
-			uint8 d2 = d1;
-			float32 min_cost = Large_Float;
+		P* cost_last_path = path_buffer<P>(0, thread_id);
+		// the path of the current pixel, kept in P so the recurrence does not accumulate the quantization error of T
+		P* cost_cur_path = path_buffer<P>(1, thread_id);
+		// path costs of the current pixel
+		P* cost_buffer = path_buffer<P>(3, thread_id);
+
+		for (sint32 y = y_begin; y < y_end; y++) {
+			// ·��ͷΪÿһ�е���(β,dir=-1)������
+			auto cost_init_row = (is_forward) ? (cost_so_src + y * width * disp_range) : (cost_so_src + y * width * disp_range + (width - 1) * disp_range);
+			auto cost_aggr_row = (is_forward) ? (cost_so_dst + y * width * disp_range) : (cost_so_dst + y * width * disp_range + (width - 1) * disp_range);
+			const uint8* codes_row = &vec_right_codes_[0][y * codes_stride];
+			sint32 x = (is_forward) ? 0 : width - 1;
+
+			std::fill(cost_last_path, cost_last_path + disp_range + 2, PathTraits<P>::Large());
+			std::fill(cost_cur_path, cost_cur_path + disp_range + 2, PathTraits<P>::Large());
+
+			// ��ʼ������һ�����صľۺϴ���ֵ���ڳ�ʼ����ֵ
+			memcpy(cost_aggr_row, cost_init_row, disp_range * sizeof(T));
 			for (sint32 d = 0; d < disp_range; d++) {
-				const sint32 xr = x - d - min_disparity;
-				if (xr > 0 && xr < width - 1) {
-					const ADColor color_r = ADColor(img_row_r[3 * xr], img_row_r[3 * xr + 1], img_row_r[3 * xr + 2]);
-					const ADColor color_last_r = ADColor(img_row_r[3 * (xr - direction)],
-						img_row_r[3 * (xr - direction) + 1],
-						img_row_r[3 * (xr - direction) + 2]);
-					d2 = ColorDist(color_r, color_last_r);
-				}
-
-				// ����P1��P2
-				float32 P1(0.0f), P2(0.0f);
-				if (d1 < tso && d2 < tso) {
-					P1 = p1; P2 = p2;
-				}
-				else if (d1 < tso && d2 >= tso) {
-					P1 = p1 / 4; P2 = p2 / 4;
-				}
-				else if (d1 >= tso && d2 < tso) {
-					P1 = p1 / 4; P2 = p2 / 4;
-				}
-				else if (d1 >= tso && d2 >= tso) {
-					P1 = p1 / 10; P2 = p2 / 10;
-				}
-
-				// Lr(p,d) = C(p,d) + min( Lr(p-r,d), Lr(p-r,d-1) + P1, Lr(p-r,d+1) + P1, min(Lr(p-r))+P2 ) - min(Lr(p-r))
-				const float32  cost = cost_init_row[d];
-				const float32 l1 = cost_last_path[d + 1];
-				const float32 l2 = cost_last_path[d] + P1;
-				const float32 l3 = cost_last_path[d + 2] + P1;
-				const float32 l4 = mincost_last_path + P2;
-
-				float32 cost_s = cost + static_cast<float32>(std::min(std::min(l1, l2), std::min(l3, l4)));
-				cost_s /= 2;
-
-				cost_aggr_row[d] = cost_s;
-				min_cost = std::min(min_cost, cost_s);
+				cost_last_path[d + 1] = PathTraits<P>::Load(cost_init_row[d]);
 			}
-
-			// �����ϸ����ص���С����ֵ�ʹ�������
-			mincost_last_path = min_cost;
-			memcpy(&cost_last_path[1], cost_aggr_row, disp_range * sizeof(float32));
-
-			// ��һ������
 			cost_init_row += direction * disp_range;
 			cost_aggr_row += direction * disp_range;
-			img_row += direction * 3;
 			x += direction;
 
-			// ����ֵ���¸�ֵ
-			color_last = color;
+			// ·�����ϸ����ص���С����ֵ
+			P mincost_last_path = PathTraits<P>::Large();
+			for (sint32 d = 0; d < disp_range + 2; d++) {
+				mincost_last_path = std::min(mincost_last_path, cost_last_path[d]);
+			}
+
+			// �Է����ϵ�2�����ؿ�ʼ��˳��ۺ�
+			for (sint32 j = 0; j < width - 1; j++) {
+				// P1 and P2 of the codes
+				P p1_lut[8], p2_lut[8];
+				PenaltyLut(left_steps[y * width + x], is_forward, x, codes_row, p1_lut, p2_lut);
+
+				// Lr(p,d) = C(p,d) + min( Lr(p-r,d), Lr(p-r,d-1) + P1, Lr(p-r,d+1) + P1, min(Lr(p-r))+P2 ) - min(Lr(p-r))
+				const P min_cost = path_step(LoadCosts(cost_init_row, cost_buffer, disp_range), cost_last_path, cost_cur_path,
+					codes_row + width - 1 - x, disp_range, p1_lut, p2_lut, mincost_last_path);
+				StoreCosts(&cost_cur_path[1], cost_aggr_row, disp_range);
+
+				// �����ϸ����ص���С����ֵ�ʹ�������
+				mincost_last_path = min_cost;
+				std::swap(cost_last_path, cost_cur_path);
+
+				// ��һ������
+				cost_init_row += direction * disp_range;
+				cost_aggr_row += direction * disp_range;
+				x += direction;
+			}
 		}
-	}
+	});
 }
 
-void ScanlineOptimizer::ScanlineOptimizeUpDown(const float32* cost_so_src, float32* cost_so_dst, bool is_forward)
+template<typename T, typename P>
+void ScanlineOptimizer::ScanlineOptimizeRows(const T* cost_so_src, T* cost_so_dst, const sint32& orientation, bool is_forward,
+	const bool& compute_disparity, const T* cost_acc, const float32& acc_weight, const float32& path_weight)
 {
 	const auto width = width_;
 	const auto height = height_;
 	const auto min_disparity = min_disparity_;
 	const auto max_disparity = max_disparity_;
-	const auto p1 = so_p1_;
-	const auto p2 = so_p2_;
-	const auto tso = so_tso_;
-	
+
 	assert(width > 0 && height > 0 && max_disparity > min_disparity);
 
-	// �ӲΧ
 	const sint32 disp_range = max_disparity - min_disparity;
-
-	// ����(��->��) ��is_forward = true ; direction = 1
-	// ����(��->��) ��is_forward = false; direction = -1;
+	const sint32 path_stride = disp_range + 2;
 	const sint32 direction = is_forward ? 1 : -1;
-
-	// �ۺ�
-	for (sint32 x = 0; x < width; x++) {
-		// ·��ͷΪÿһ�е���(β,dir=-1)������
-		auto cost_init_col = (is_forward) ? (cost_so_src + x * disp_range) : (cost_so_src + (height - 1) * width * disp_range + x * disp_range);
-		auto cost_aggr_col = (is_forward) ? (cost_so_dst + x * disp_range) : (cost_so_dst + (height - 1) * width * disp_range + x * disp_range);
-		auto img_col = (is_forward) ? (img_left_ + 3 * x) : (img_left_ + (height - 1) * width * 3 + 3 * x);
-		sint32 y = (is_forward) ? 0 : height - 1;
-
-		// ·���ϵ�ǰ�Ҷ�ֵ����һ���Ҷ�ֵ
-		ADColor color(img_col[0], img_col[1], img_col[2]);
-		ADColor color_last = color;
-
-		// ·�����ϸ����صĴ������飬������Ԫ����Ϊ�˱���߽��������β����һ����
-		std::vector<float32> cost_last_path(disp_range + 2, Large_Float);
-
-		// ��ʼ������һ�����صľۺϴ���ֵ���ڳ�ʼ����ֵ
-		memcpy(cost_aggr_col, cost_init_col, disp_range * sizeof(float32));
-		memcpy(&cost_last_path[1], cost_aggr_col, disp_range * sizeof(float32));
-		cost_init_col += direction * width * disp_range;
-		cost_aggr_col += direction * width * disp_range;
-		img_col += direction * width * 3;
-		y += direction;
-
-		// ·�����ϸ����ص���С����ֵ
-		float32 mincost_last_path = Large_Float;
-		for (auto cost : cost_last_path) {
-			mincost_last_path = std::min(mincost_last_path, cost);
+	const sint32 dx = kPathOrientations[orientation].dx;
+	const sint32 dy = kPathOrientations[orientation].dy;
+	// pixel (x, y) is on line x - dx * (y / dy) - l_min of the rows y % dy, see LineParts
+	const sint32 l_min = dx > 0 ? -dx * ((height - 1) / dy) : 0;
+
+	const uint8* left_steps = &vec_left_steps_[orientation][0];
+	const uint8* codes = &vec_right_codes_[orientation][0];
+	const sint32 codes_stride = width + disp_range;
+	const typename PathTraits<P>::StepFunc path_step = PathTraits<P>::SelectStepFunc();
+	const auto& parts = vec_line_parts_[orientation];
+	const sint32 num_parts = static_cast<sint32>(parts.size()) - 1;
+	float32* row_costs = compute_disparity ? &vec_row_costs_[0] : nullptr;
+
+	// path costs of the lines on the last and the current row of every row set y % dy,
+	// the rows r = y / dy of a set alternate between the two buffers
+	const auto begin_part = [&](const sint32& part, const sint32& thread_id) {
+		const sint32 num_lines = parts[part + 1] - parts[part];
+		std::fill(path_buffer<P>(0, thread_id), path_buffer<P>(0, thread_id) + dy * num_lines * path_stride, PathTraits<P>::Large());
+		std::fill(path_buffer<P>(1, thread_id), path_buffer<P>(1, thread_id) + dy * num_lines * path_stride, PathTraits<P>::Large());
+	};
+
+	// the blended costs of pixel (x, y) go to the volume or to the row buffer
+	const auto blend = [&](const sint32& x, const sint32& y, const P* path) {
+		const size_t offset = static_cast<size_t>(y * width + x) * disp_range;
+		if (compute_disparity) {
+			BlendRowCosts<T>(path, cost_acc + offset, acc_weight, path_weight, row_costs + x * disp_range, disp_range);
 		}
-
-		// �Է����ϵ�2�����ؿ�ʼ��˳��ۺ�
-		for (sint32 i = 0; i < height - 1; i++) {
-			color = ADColor(img_col[0], img_col[1], img_col[2]);
-			const uint8 d1 = ColorDist(color, color_last);
-			uint8 d2 = d1;
-			float32 min_cost = Large_Float;
-			for (sint32 d = 0; d < disp_range; d++) {
-				const sint32 xr = x - d - min_disparity;
-				if (xr > 0 && xr < width - 1) {
-					const ADColor color_r = ADColor(img_right_[y * width * 3 + 3 * xr], img_right_[y * width * 3 + 3 * xr + 1], img_right_[y * width * 3 + 3 * xr + 2]);
-					const ADColor color_last_r = ADColor(img_right_[(y - direction) * width * 3 + 3 * xr],
-						img_right_[(y - direction) * width * 3 + 3 * xr + 1],
-						img_right_[(y - direction) * width * 3 + 3 * xr + 2]);
-					d2 = ColorDist(color_r, color_last_r);
-				}
-				// ����P1��P2
-				float32 P1(0.0f), P2(0.0f);
-				if (d1 < tso && d2 < tso) {
-					P1 = p1; P2 = p2;
+		else {
+			BlendCosts<T>(path, cost_acc + offset, acc_weight, path_weight, cost_so_dst + offset, disp_range);
+		}
+	};
+
+	// one step of the lines of a part on row y, the costs go to the volume or to the row buffer
+	const auto sweep_row = [&](const sint32& part, const sint32& thread_id, const sint32& y) {
+		const sint32 line_begin = parts[part];
+		const sint32 line_end = parts[part + 1];
+		const sint32 num_lines = line_end - line_begin;
+		// min path cost of every line on the last row of its set
+		P* mincost_lines = path_buffer<P>(2, thread_id);
+		// path costs of the current pixel
+		P* cost_buffer = path_buffer<P>(3, thread_id);
+
+		const sint32 r = y / dy;
+		// line l is at x = l + x_shift on this row
+		const sint32 x_shift = l_min + dx * r;
+		const sint32 x_begin = std::max(line_begin + x_shift, 0);
+		const sint32 x_end = std::min(line_end + x_shift, width);
+		const sint32 line_offset = (y % dy) * num_lines - line_begin - x_shift;
+		const P* cost_last_line = path_buffer<P>((r + 1) & 1, thread_id);
+		P* cost_cur_line = path_buffer<P>(r & 1, thread_id);
+		const uint8* codes_row = codes + y * codes_stride;
+		const sint32 yp = y - direction * dy;
+
+		for (sint32 x = x_begin; x < x_end; x++) {
+			const sint32 k = line_offset + x;
+			const T* cost_init = cost_so_src + (y * width + x) * disp_range;
+			P* cost_cur_path = cost_cur_line + k * path_stride;
+
+			// the predecessor is outside of the image: first pixel of the path
+			const sint32 xp = x - direction * dx;
+			if (xp < 0 || xp >= width || yp < 0 || yp >= height) {
+				P min_cost = PathTraits<P>::Large();
+				for (sint32 d = 0; d < disp_range; d++) {
+					cost_cur_path[d + 1] = PathTraits<P>::Load(cost_init[d]);
+					min_cost = std::min(min_cost, cost_cur_path[d + 1]);
 				}
-				else if (d1 < tso && d2 >= tso) {
-					P1 = p1 / 4; P2 = p2 / 4;
+				mincost_lines[k] = min_cost;
+				if (cost_acc != nullptr) {
+					blend(x, y, cost_cur_path + 1);
 				}
-				else if (d1 >= tso && d2 < tso) {
-					P1 = p1 / 4; P2 = p2 / 4;
+				else if (compute_disparity) {
+					for (sint32 d = 0; d < disp_range; d++) {
+						row_costs[x * disp_range + d] = CostTraits<T>::Load(cost_init[d]);
+					}
 				}
-				else if (d1 >= tso && d2 >= tso) {
-					P1 = p1 / 10; P2 = p2 / 10;
+				else {
+					memcpy(cost_so_dst + (y * width + x) * disp_range, cost_init, disp_range * sizeof(T));
 				}
+				continue;
+			}
 
-				// Lr(p,d) = C(p,d) + min( Lr(p-r,d), Lr(p-r,d-1) + P1, Lr(p-r,d+1) + P1, min(Lr(p-r))+P2 ) - min(Lr(p-r))
-				const float32  cost = cost_init_col[d];
-				const float32 l1 = cost_last_path[d + 1];
-				const float32 l2 = cost_last_path[d] + P1;
-				const float32 l3 = cost_last_path[d + 2] + P1;
-				const float32 l4 = mincost_last_path + P2;
+			// P1 and P2 of the codes, the left color step of two path pixels is stored at the later one of a forward path
+			P p1_lut[8], p2_lut[8];
+			const uint8 d1_flag = is_forward ? left_steps[y * width + x] : left_steps[yp * width + xp];
+			PenaltyLut(d1_flag, is_forward, x, codes_row, p1_lut, p2_lut);
+
+			// Lr(p,d) = C(p,d) + min( Lr(p-r,d), Lr(p-r,d-1) + P1, Lr(p-r,d+1) + P1, min(Lr(p-r))+P2 ) - min(Lr(p-r))
+			mincost_lines[k] = path_step(LoadCosts(cost_init, cost_buffer, disp_range), cost_last_line + k * path_stride, cost_cur_path,
+				codes_row + width - 1 - x, disp_range, p1_lut, p2_lut, mincost_lines[k]);
+			if (cost_acc != nullptr) {
+				blend(x, y, cost_cur_path + 1);
+			}
+			else if (compute_disparity) {
+				StoreRowCosts<T>(cost_cur_path + 1, row_costs + x * disp_range, disp_range);
+			}
+			else {
+				StoreCosts(cost_cur_path + 1, cost_so_dst + (y * width + x) * disp_range, disp_range);
+			}
+		}
+	};
+
+	if (!compute_disparity) {
+		// the lines are independent paths, every thread sweeps the rows through the lines of its part
+		// so that each step reads and writes a contiguous run of the cost volume
+		ThreadPool::ParallelFor(thread_pool_, 0, num_parts, [&](const sint32& part_begin, const sint32& part_end, const sint32& thread_id) {
+			for (sint32 part = part_begin; part < part_end; part++) {
+				begin_part(part, thread_id);
+				for (sint32 i = 0; i < height; i++) {
+					sweep_row(part, thread_id, is_forward ? i : height - 1 - i);
+				}
+			}
+		});
+		return;
+	}
 
-				float32 cost_s = cost + static_cast<float32>(std::min(std::min(l1, l2), std::min(l3, l4)));
-				cost_s /= 2;
+	// the right view needs the costs of the whole row: the threads sweep every row together, part k stays on thread k,
+	// then the disparities of both views are taken from the row buffer instead of a second read of the volume
+	ThreadPool::ParallelFor(thread_pool_, 0, num_parts, [&](const sint32& part_begin, const sint32& part_end, const sint32& thread_id) {
+		assert(part_end - part_begin == 1 && part_begin == thread_id);
+		begin_part(part_begin, thread_id);
+	});
+	for (sint32 i = 0; i < height; i++) {
+		const sint32 y = is_forward ? i : height - 1 - i;
+		ThreadPool::ParallelFor(thread_pool_, 0, num_parts, [&](const sint32& part_begin, const sint32&, const sint32& thread_id) {
+			sweep_row(part_begin, thread_id, y);
+		});
+		ThreadPool::ParallelFor(thread_pool_, 0, width, [&](const sint32& x_begin, const sint32& x_end, const sint32&) {
+			adcensus_util::ComputeDisparityRow(row_costs, width, min_disparity, max_disparity, x_begin, x_end, disp_left_ + y * width,
+				disp_right_ != nullptr ? disp_right_ + y * width : nullptr, &vec_right_min_[0], &vec_right_best_[0],
+				confidence_ != nullptr ? confidence_ + y * width : nullptr, confidence_measure_);
+		});
+	}
+}
 
-				cost_aggr_col[d] = cost_s;
-				min_cost = std::min(min_cost, cost_s);
+void ScanlineOptimizer::BuildPenaltyMaps()
+{
+	const sint32 disp_range = max_disparity_ - min_disparity_;
+	const sint32 codes_stride = width_ + disp_range;
+	const sint32 img_size = width_ * height_;
+	const sint32 num_orientations = so_num_paths_ / 2;
+	vec_left_steps_.resize(num_orientations);
+	vec_right_codes_.resize(num_orientations);
+	vec_right_steps_.resize(img_size);
+
+	for (sint32 k = 0; k < num_orientations; k++) {
+		const sint32 dx = kPathOrientations[k].dx;
+		const sint32 dy = kPathOrientations[k].dy;
+		vec_left_steps_[k].resize(img_size);
+		vec_right_codes_[k].resize(static_cast<size_t>(height_) * codes_stride);
+
+		// color step of a pixel from its forward predecessor (x - dx, y - dy) reaches tso, 0 if there is no predecessor
+		const auto step = [&](const uint8* img, const sint32& x, const sint32& y) -> uint8 {
+			const sint32 xn = x - dx;
+			const sint32 yn = y - dy;
+			if (xn < 0 || yn < 0 || xn >= width_) {
+				return 0;
+			}
+			const uint8* c0 = img + 3 * (y * width_ + x);
+			const uint8* c1 = img + 3 * (yn * width_ + xn);
+			return ColorDist(ADColor(c0[0], c0[1], c0[2]), ADColor(c1[0], c1[1], c1[2])) >= so_tso_ ? 1 : 0;
+		};
+		ThreadPool::ParallelFor(thread_pool_, 0, height_, [&](const sint32& y_begin, const sint32& y_end, const sint32&) {
+			for (sint32 y = y_begin; y < y_end; y++) {
+				for (sint32 x = 0; x < width_; x++) {
+					vec_left_steps_[k][y * width_ + x] = step(img_left_, x, y);
+					vec_right_steps_[y * width_ + x] = step(img_right_, x, y);
+				}
+			}
+		});
+
+		const auto right_step = [&](const sint32& x, const sint32& y) -> uint8 {
+			return (x >= 0 && x < width_ && y >= 0 && y < height_) ? vec_right_steps_[y * width_ + x] : 0;
+		};
+		ThreadPool::ParallelFor(thread_pool_, 0, height_, [&](const sint32& y_begin, const sint32& y_end, const sint32&) {
+			for (sint32 y = y_begin; y < y_end; y++) {
+				// code c of xr: bit 0 step from the forward predecessor, bit 1 step from the backward predecessor
+				const auto code = [&](const sint32& xr) -> uint8 {
+					return right_step(xr, y) | (right_step(xr + dx, y + dy) << 1);
+				};
+				uint8* codes = &vec_right_codes_[k][y * codes_stride];
+				for (sint32 i = 0; i < codes_stride - 1; i++) {
+					const sint32 xr = width_ - 1 - min_disparity_ - i;
+					if (xr >= width_ - 1) {
+						codes[i] = 4;
+					}
+					else if (xr <= 0) {
+						codes[i] = 5;
+					}
+					else {
+						codes[i] = code(xr);
+					}
+				}
+				codes[codes_stride - 1] = width_ >= 3 ? code(1) : 0;
 			}
+		});
+	}
+}
 
-			// �����ϸ����ص���С����ֵ�ʹ�������
-			mincost_last_path = min_cost;
-			memcpy(&cost_last_path[1], cost_aggr_col, disp_range * sizeof(float32));
+void ScanlineOptimizer::LineParts(const sint32& orientation, const sint32& num_parts, vector<sint32>& parts) const
+{
+	const sint32 dx = kPathOrientations[orientation].dx;
+	const sint32 dy = kPathOrientations[orientation].dy;
+	const sint32 adx = abs(dx);
+	const sint32 l_min = dx > 0 ? -dx * ((height_ - 1) / dy) : 0;
+	const sint32 num_lines = width_ + adx * ((height_ - 1) / dy);
+
+	// number of pixels of line l, in every row set y % dy the pixels are at x = l + l_min + dx * r, r = y / dy
+	const auto line_pixels = [&](const sint32& l) -> sint32 {
+		const sint32 c = l + l_min;
+		sint32 count = 0;
+		for (sint32 set = 0; set < dy && set < height_; set++) {
+			const sint32 num_rows = (height_ - 1 - set) / dy + 1;
+			if (dx == 0) {
+				count += num_rows;
+				continue;
+			}
+			sint32 r_begin = dx > 0 ? -FloorDiv(c, dx) : -FloorDiv(width_ - 1 - c, adx);
+			sint32 r_last = dx > 0 ? FloorDiv(width_ - 1 - c, dx) : FloorDiv(c, adx);
+			r_begin = std::max(r_begin, 0);
+			r_last = std::min(r_last, num_rows - 1);
+			count += std::max(r_last - r_begin + 1, 0);
+		}
+		return count;
+	};
+
+	// the lines are cut where the running pixel count passes k / num_parts of the image
+	const sint64 img_size = static_cast<sint64>(width_) * height_;
+	parts.assign(num_parts + 1, num_lines);
+	parts[0] = 0;
+	sint64 pixels = 0;
+	sint32 k = 1;
+	for (sint32 l = 0; l < num_lines && k < num_parts; l++) {
+		pixels += line_pixels(l);
+		while (k < num_parts && pixels * num_parts >= img_size * k) {
+			parts[k++] = l + 1;
+		}
+	}
+}
 
-			// ��һ������
-			cost_init_col += direction * width * disp_range;
-			cost_aggr_col += direction * width * disp_range;
-			img_col += direction * width * 3;
-			y += direction;
+void ScanlineOptimizer::AllocatePathBuffers()
+{
+	const sint32 num_threads = thread_pool_ != nullptr ? thread_pool_->num_threads() : 1;
+
+	// the up/down and diagonal passes split the lines into parts of about the same number of pixels
+	path_strip_width_ = 1;
+	vec_line_parts_.resize(so_num_paths_ / 2);
+	for (sint32 k = 1; k < so_num_paths_ / 2; k++) {
+		auto& parts = vec_line_parts_[k];
+		LineParts(k, num_threads, parts);
+		for (sint32 i = 0; i < num_threads; i++) {
+			path_strip_width_ = std::max(path_strip_width_, kPathOrientations[k].dy * (parts[i + 1] - parts[i]));
+		}
+	}
 
-			// ����ֵ���¸�ֵ
-			color_last = color;
+	// only the buffers of the recurrence in use are kept
+	for (sint32 k = 0; k < 4; k++) {
+		if (so_fixed_point_) {
+			vec_path_fixed_[k].resize(path_buffer_size(k) * num_threads);
+			vector<float32>().swap(vec_path_float_[k]);
+		}
+		else {
+			vec_path_float_[k].resize(path_buffer_size(k) * num_threads);
+			vector<uint16>().swap(vec_path_fixed_[k]);
 		}
 	}
+
+	// one row of costs and the right view min buffer for the disparities of the last pass
+	if (disp_left_ != nullptr) {
+		vec_row_costs_.resize(static_cast<size_t>(width_) * (max_disparity_ - min_disparity_));
+		vec_right_min_.resize(width_);
+		vec_right_best_.resize(width_);
+	}
+	else {
+		vector<float32>().swap(vec_row_costs_);
+		vector<float32>().swap(vec_right_min_);
+		vector<sint32>().swap(vec_right_best_);
+	}
+}
+
+size_t ScanlineOptimizer::path_buffer_size(const sint32& k) const
+{
+	const sint32 disp_range = max_disparity_ - min_disparity_;
+	switch (k) {
+	case 0:
+	case 1:
+		return static_cast<size_t>(path_strip_width_) * (disp_range + 2);
+	case 2:
+		return path_strip_width_;
+	default:
+		return disp_range;
+	}
+}
+
+template<typename P>
+void ScanlineOptimizer::PenaltyLut(const uint8& d1_flag, const bool& is_forward, const sint32& x, const uint8* codes_row,
+	P* p1_lut, P* p2_lut) const
+{
+	// number of the color distances d1, d2 that reach tso, for each code
+	const sint32 shift = is_forward ? 0 : 1;
+	const sint32 d2_low = (codes_row[width_ + max_disparity_ - min_disparity_ - 1] >> shift) & 1;
+	// d2 left of the image keeps the value of xr = 1 if the disparities passed it, otherwise it is d1
+	const sint32 low_flag = (x - min_disparity_ >= 1 && width_ >= 3) ? d2_low : d1_flag;
+	const sint32 count[8] = { d1_flag, d1_flag + ((1 >> shift) & 1), d1_flag + ((2 >> shift) & 1), d1_flag + ((3 >> shift) & 1),
+							  2 * d1_flag, d1_flag + low_flag, 0, 0 };
+
+	const P p1[3] = { PathTraits<P>::Penalty(so_p1_), PathTraits<P>::Penalty(so_p1_ / 4), PathTraits<P>::Penalty(so_p1_ / 10) };
+	const P p2[3] = { PathTraits<P>::Penalty(so_p2_), PathTraits<P>::Penalty(so_p2_ / 4), PathTraits<P>::Penalty(so_p2_ / 10) };
+	for (sint32 k = 0; k < 8; k++) {
+		p1_lut[k] = p1[count[k]];
+		p2_lut[k] = p2[count[k]];
+	}
 }
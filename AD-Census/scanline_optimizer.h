@@ -10,6 +10,8 @@
 #include <algorithm>
 
 #include "adcensus_types.h"
+#include "cost_volume.h"
+#include "thread_pool.h"
 
 /**
  * \brief ɨŻ
@@ -27,7 +29,24 @@ public:
 	 * \param cost_init 	// ʼ
 	 * \param cost_aggr 	// ۺϴ
 	 */
-	void SetData(const uint8* img_left, const uint8* img_right, float32* cost_init, float32* cost_aggr);
+	void SetData(const uint8* img_left, const uint8* img_right, CostVolume* cost_init, CostVolume* cost_aggr);
+
+	/**
+	 * \brief set the thread pool the passes run on, the rows (left/right) and path lines (up/down, diagonals) are split between the threads
+	 * \param thread_pool	thread pool, nullptr: run on the calling thread
+	 */
+	void SetThreadPool(ThreadPool* thread_pool);
+
+	/**
+	 * \brief compute the disparities of both views in the last pass instead of writing its costs to the aggregated volume,
+	 * the volume then keeps the costs of the pass before. The disparities are the same as from the volume.
+	 * \param disp_left		left disparity map, width * height, nullptr: the last pass writes the volume
+	 * \param disp_right	right disparity map, width * height, nullptr: no right view
+	 * \param confidence	confidence map of the left disparities, width * height, nullptr: no confidence
+	 * \param measure		confidence measure
+	 */
+	void SetDisparityOutput(float32* disp_left, float32* disp_right, float32* confidence = nullptr,
+		const ConfidenceMeasure& measure = ConfidencePeakRatio);
 
 	/**
 	 * \brief 
@@ -38,29 +57,100 @@ public:
 	 * \param p1			// p1
 	 * \param p2			// p2
 	 * \param tso			// tso
+	 * \param num_paths		// number of paths: 4 (left/right, up/down), 8 (+ diagonals) or 16 (+ knight moves)
+	 * \param fixed_point	// true: uint16 fixed point path costs at the scale of CostTraits<uint16>, false: float32
 	 */
-	void SetParam(const sint32& width,const sint32& height, const sint32& min_disparity, const sint32& max_disparity, const float32& p1, const float32& p2, const sint32& tso);
+	void SetParam(const sint32& width,const sint32& height, const sint32& min_disparity, const sint32& max_disparity, const float32& p1, const float32& p2, const sint32& tso,
+		const sint32& num_paths = 4, const bool& fixed_point = false);
 
 	/**
 	 * \brief Ż */
 	void Optimize();
 
 private:
+	/** \brief the passes on a volume of storage type T, with the path cost type of the option */
+	template<typename T>
+	void Optimize(T* cost_init, T* cost_aggr);
+
+	/** \brief the passes on a volume of storage type T with path costs of type P, float32 or uint16 fixed point */
+	template<typename T, typename P>
+	void Optimize(T* cost_init, T* cost_aggr);
+
 	/**
 	* \brief ·Ż  
 	* \param cost_so_src		룬SOǰ
 	* \param cost_so_dst		SO
 	* \param is_forward			룬ǷΪΪңΪҵ
 	*/
-	void ScanlineOptimizeLeftRight(const float32* cost_so_src, float32* cost_so_dst, bool is_forward = true);
+	template<typename T, typename P>
+	void ScanlineOptimizeLeftRight(const T* cost_so_src, T* cost_so_dst, bool is_forward = true);
 
 	/**
-	* \brief ·Ż  
-	* \param cost_so_src		룬SOǰ
-	* \param cost_so_dst		SO
-	* \param is_forward			룬ǷΪΪϵ£Ϊµϣ
+	* \brief path optimization along the rows: up/down (orientation 1) and the diagonals, the paths step by (dx, dy) of the orientation
+	* The pixels (x, y) with the same x - dx * (y / dy) and y % dy form a path line, every thread sweeps the rows through
+	* the lines of its part and keeps the last path costs of every line.
+	* \param cost_so_src		input, costs before the pass
+	* \param cost_so_dst		output, costs after the pass
+	* \param orientation		orientation index, 1 to num_paths / 2 - 1
+	* \param is_forward		true: the paths step by (dx, dy), false: by (-dx, -dy)
+	* \param compute_disparity	true: the threads sweep every row together and compute the disparities of the row
+	*							into the disparity output, cost_so_dst is not written
+	* \param cost_acc			nullptr: the path costs are the output, else the output is
+	*							acc_weight * cost_acc + path_weight * path costs, cost_acc may be cost_so_dst
+	* \param acc_weight		weight of cost_acc
+	* \param path_weight		weight of the path costs
+	*/
+	template<typename T, typename P>
+	void ScanlineOptimizeRows(const T* cost_so_src, T* cost_so_dst, const sint32& orientation, bool is_forward = true,
+		const bool& compute_disparity = false, const T* cost_acc = nullptr, const float32& acc_weight = 0.0f,
+		const float32& path_weight = 1.0f);
+
+	/**
+	* \brief build the color step maps of both images for the P1/P2 choice, once per frame for all paths
+	* Left step maps: 1 if the color distance of a pixel to its forward predecessor >= tso, one map per orientation.
+	* Right code maps: one row of width + disp_range codes per image row, code k of row y belongs to
+	* xr = width - 1 - min_disparity - k, so the codes of pixel x are contiguous from width - 1 - x:
+	*   bit 0/1: color distance d2 of xr to its forward/backward predecessor >= tso,
+	*   4: xr right of the image, d2 = d1, 5: xr left of the image
+	* The last code of a row is the code of xr = 1.
+	*/
+	void BuildPenaltyMaps();
+
+	/**
+	* \brief split the path lines of an up/down or diagonal orientation into parts of about the same number of pixels
+	* \param orientation	orientation index
+	* \param num_parts		number of parts
+	* \param parts			output, part k is the lines [parts[k], parts[k + 1])
 	*/
-	void ScanlineOptimizeUpDown(const float32* cost_so_src, float32* cost_so_dst, bool is_forward = true);
+	void LineParts(const sint32& orientation, const sint32& num_parts, vector<sint32>& parts) const;
+
+	/**
+	* \brief size the per-thread path buffers for the current size, paths, thread count and path cost type,
+	* every thread owns a slice of path_buffer_size(k) elements of buffer k
+	*/
+	void AllocatePathBuffers();
+
+	/**
+	* \brief elements of path buffer k of one thread
+	* 0/1: path costs of the last/current line, a strip of path_strip_width_ pixels with one element of padding at both ends,
+	* 2: min path costs of the strip, 3: path costs of the current pixel
+	*/
+	size_t path_buffer_size(const sint32& k) const;
+
+	/** \brief path buffer k of a thread, of the float32 (P = float32) or the fixed point (P = uint16) recurrence */
+	template<typename P>
+	P* path_buffer(const sint32& k, const sint32& thread_id);
+
+	/**
+	* \brief P1 and P2 of the eight codes for a path step
+	* \param d1_flag		1 if the color distance d1 of the left pixel to its predecessor >= tso
+	* \param is_forward		path direction
+	* \param x				column of the left pixel
+	* \param codes_row		codes of the image row
+	*/
+	template<typename P>
+	void PenaltyLut(const uint8& d1_flag, const bool& is_forward, const sint32& x, const uint8* codes_row,
+		P* p1_lut, P* p2_lut) const;
 
 	/** \brief ɫ */
 	inline sint32 ColorDist(const ADColor& c1, const ADColor& c2) {
@@ -77,9 +167,40 @@ private:
 	const uint8* img_right_;
 	
 	/** \brief ʼ */
-	float32* cost_init_;
+	CostVolume* cost_init_;
 	/** \brief ۺϴ */
-	float32* cost_aggr_;
+	CostVolume* cost_aggr_;
+
+	/** \brief thread pool, nullptr: single threaded */
+	ThreadPool* thread_pool_;
+
+	/** \brief color step maps of the left image, per orientation: [0] horizontal, [1] vertical, then the diagonals */
+	vector<vector<uint8>> vec_left_steps_;
+	/** \brief P1/P2 codes of the right image, per orientation */
+	vector<vector<uint8>> vec_right_codes_;
+	/** \brief color step map of the right image of the orientation being built */
+	vector<uint8> vec_right_steps_;
+
+	/** \brief line parts of the threads in the up/down and diagonal passes, per orientation */
+	vector<vector<sint32>> vec_line_parts_;
+	/** \brief widest strip of a thread in path lines, the lines of all row sets of its part */
+	sint32 path_strip_width_;
+
+	/** \brief path buffers of the float32 and the fixed point recurrence, per thread, see path_buffer_size() */
+	vector<float32> vec_path_float_[4];
+	vector<uint16> vec_path_fixed_[4];
+
+	/** \brief disparity output of the last pass, nullptr: the last pass writes the volume */
+	float32* disp_left_;
+	float32* disp_right_;
+	/** \brief confidence output of the last pass, nullptr: no confidence */
+	float32* confidence_;
+	ConfidenceMeasure confidence_measure_;
+	/** \brief costs of the row being swept by the last pass, width * disp_range */
+	vector<float32> vec_row_costs_;
+	/** \brief running min cost and its disparity of the right view pixels of the row */
+	vector<float32> vec_right_min_;
+	vector<sint32> vec_right_best_;
 
 	/** \brief СӲֵ */
 	sint32 min_disparity_;
@@ -91,5 +212,9 @@ private:
 	float32 so_p2_;
 	/** \brief tsoֵ */
 	sint32 so_tso_;
+	/** \brief number of paths */
+	sint32 so_num_paths_;
+	/** \brief uint16 fixed point path costs */
+	bool so_fixed_point_;
 };
 #endif
@@ -0,0 +1,123 @@
+/* -*-c++-*- AD-Census - Copyright (C) 2020.
+* Author	: Yingsong Li(Ethan Li) <ethan.li.whu@gmail.com>
+* https://github.com/ethan-li-coding/AD-Census
+* Describe	: implement of class ThreadPool
+*/
+
+#include "thread_pool.h"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(): num_threads_(1), func_(nullptr), begin_(0), end_(0),
+                          generation_(0), pending_(0), stop_(false) { }
+
+ThreadPool::~ThreadPool()
+{
+	Release();
+}
+
+bool ThreadPool::Initialize(const sint32& num_threads)
+{
+	Release();
+
+	sint32 n = num_threads;
+	if (n <= 0) {
+		n = static_cast<sint32>(std::thread::hardware_concurrency());
+		n = std::max(n, 1);
+	}
+
+	num_threads_ = n;
+	stop_ = false;
+	workers_.reserve(n - 1);
+	for (sint32 k = 1; k < n; k++) {
+		workers_.emplace_back(&ThreadPool::WorkerLoop, this, k, generation_);
+	}
+	return true;
+}
+
+void ThreadPool::Release()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stop_ = true;
+	}
+	cv_start_.notify_all();
+	for (auto& worker : workers_) {
+		worker.join();
+	}
+	workers_.clear();
+	num_threads_ = 1;
+}
+
+void ThreadPool::ParallelFor(const sint32& begin, const sint32& end, const LoopFunc& func)
+{
+	if (end <= begin) {
+		return;
+	}
+	if (workers_.empty()) {
+		func(begin, end, 0);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		func_ = &func;
+		begin_ = begin;
+		end_ = end;
+		pending_ = static_cast<sint32>(workers_.size());
+		generation_++;
+	}
+	cv_start_.notify_all();
+
+	RunPart(0);
+
+	std::unique_lock<std::mutex> lock(mutex_);
+	cv_done_.wait(lock, [this] { return pending_ == 0; });
+	func_ = nullptr;
+}
+
+void ThreadPool::ParallelFor(ThreadPool* pool, const sint32& begin, const sint32& end, const LoopFunc& func)
+{
+	if (pool != nullptr) {
+		pool->ParallelFor(begin, end, func);
+	}
+	else if (end > begin) {
+		func(begin, end, 0);
+	}
+}
+
+void ThreadPool::WorkerLoop(const sint32& thread_id, uint64 generation)
+{
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			cv_start_.wait(lock, [this, generation] { return stop_ || generation_ != generation; });
+			if (stop_) {
+				return;
+			}
+			generation = generation_;
+		}
+
+		RunPart(thread_id);
+
+		bool last = false;
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			last = (--pending_ == 0);
+		}
+		if (last) {
+			cv_done_.notify_one();
+		}
+	}
+}
+
+void ThreadPool::RunPart(const sint32& thread_id) const
+{
+	// part k is [begin + n * k / t, begin + n * (k + 1) / t)
+	const sint64 n = static_cast<sint64>(end_) - begin_;
+	const sint32 part_begin = begin_ + static_cast<sint32>(n * thread_id / num_threads_);
+	const sint32 part_end = begin_ + static_cast<sint32>(n * (thread_id + 1) / num_threads_);
+	if (part_begin < part_end) {
+		(*func_)(part_begin, part_end, thread_id);
+	}
+}
@@ -0,0 +1,91 @@
+/* -*-c++-*- AD-Census - Copyright (C) 2020.
+* Author	: Yingsong Li(Ethan Li) <ethan.li.whu@gmail.com>
+* https://github.com/ethan-li-coding/AD-Census
+* Describe	: header of class ThreadPool
+*/
+
+#ifndef AD_CENSUS_THREAD_POOL_H_
+#define AD_CENSUS_THREAD_POOL_H_
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#include "adcensus_types.h"
+
+/**
+ * \brief fixed size thread pool running static parallel-for loops
+ * A range is always split into the same contiguous parts for the same number of threads and every part is
+ * processed in order, so a loop whose parts write disjoint outputs gives the same result for any thread count.
+ */
+class ThreadPool {
+public:
+	ThreadPool();
+	~ThreadPool();
+
+	/** \brief loop body, called with the part [begin, end) and the index of the part in [0, num_threads) */
+	typedef std::function<void(const sint32& begin, const sint32& end, const sint32& thread_id)> LoopFunc;
+
+	/**
+	 * \brief start the worker threads
+	 * \param num_threads	number of threads including the calling thread, <= 0: number of hardware threads
+	 * \return true: success
+	 */
+	bool Initialize(const sint32& num_threads);
+
+	/** \brief stop the worker threads */
+	void Release();
+
+	/** \brief number of threads including the calling thread */
+	sint32 num_threads() const { return num_threads_; }
+
+	/**
+	 * \brief split [begin, end) into num_threads() contiguous parts and run func on each of them, returns when all parts are done
+	 * The calling thread runs part 0. Parts may be empty when the range is shorter than num_threads().
+	 * Must not be called from inside a loop body of the same pool.
+	 * \param begin		first index
+	 * \param end		last index + 1
+	 * \param func		loop body
+	 */
+	void ParallelFor(const sint32& begin, const sint32& end, const LoopFunc& func);
+
+	/** \brief ParallelFor on pool, or func(begin, end, 0) on the calling thread if pool is nullptr */
+	static void ParallelFor(ThreadPool* pool, const sint32& begin, const sint32& end, const LoopFunc& func);
+
+private:
+	ThreadPool(const ThreadPool&);
+	ThreadPool& operator=(const ThreadPool&);
+
+	/**
+	 * \brief worker thread main loop
+	 * \param thread_id		index of the part the worker runs
+	 * \param generation	loop generation when the worker was started
+	 */
+	void WorkerLoop(const sint32& thread_id, uint64 generation);
+
+	/** \brief run part thread_id of the current loop */
+	void RunPart(const sint32& thread_id) const;
+
+	/** \brief number of threads including the calling thread */
+	sint32 num_threads_;
+	/** \brief worker threads, thread i runs part i + 1 */
+	vector<std::thread> workers_;
+
+	std::mutex mutex_;
+	std::condition_variable cv_start_;
+	std::condition_variable cv_done_;
+
+	/** \brief current loop */
+	const LoopFunc* func_;
+	sint32 begin_;
+	sint32 end_;
+	/** \brief incremented for every loop, wakes the workers */
+	uint64 generation_;
+	/** \brief workers still running the current loop */
+	sint32 pending_;
+	/** \brief set to stop the workers */
+	bool stop_;
+};
+
+#endif
@@ -23,6 +23,15 @@ except ImportError:
 __version__ = "0.1.0"
 __all__ = ['ADCensusStereo', 'compute_disparity', 'save_disparity']
 
+# cost volume storage types, values match the CostType enum of the C++ library
+_COST_TYPES = {'float32': 0, 'uint16': 1, 'uint8': 2}
+# cost volume layouts, values match the CostLayout enum of the C++ library
+_COST_LAYOUTS = {'pixel': 0, 'disparity': 1}
+# cross aggregation methods, values match the CrossAggrMethod enum of the C++ library
+_CROSS_AGGR_METHODS = {'direct': 0, 'integral': 1}
+# confidence measures, values match the ConfidenceMeasure enum of the C++ library
+_CONFIDENCE_MEASURES = {'peak_ratio': 0, 'curvature': 1}
+
 
 class ADCensusStereo:
     """
@@ -49,6 +58,16 @@ class ADCensusStereo:
         do_lr_check (bool): Enable left-right consistency check (default: True)
         do_filling (bool): Enable disparity filling (default: True)
         do_discontinuity_adjustment (bool): Enable discontinuity adjustment (default: False)
+        cost_type (str): Cost volume storage, 'float32', 'uint16' or 'uint8' (default: 'float32')
+        cost_layout (str): Initial cost volume layout, 'pixel' or 'disparity' major (default: 'pixel')
+        num_threads (int): Number of threads, <= 0 uses all hardware threads (default: 1)
+        cross_aggr_method (str): Cross aggregation method, 'direct' or 'integral' (default: 'direct')
+        num_iters (int): Cross aggregation iterations (default: 4)
+        so_num_paths (int): Scanline optimization paths, 4, 8 or 16 (default: 4)
+        so_fixed_point (bool): Scanline optimization on uint16 fixed point path costs (default: False)
+        so_fused_wta (bool): Compute the disparities in the last scanline pass, ignored with discontinuity adjustment (default: False)
+        confidence_measure (str): Confidence returned by compute(..., return_confidence=True), 'peak_ratio' or 'curvature' (default: 'peak_ratio')
+        huge_pages (bool): Back the cost volumes and disparity maps with transparent huge pages, Linux only (default: False)
     """
     
     def __init__(self, 
@@ -68,7 +87,28 @@ class ADCensusStereo:
                  lrcheck_thres: float = 1.0,
                  do_lr_check: bool = True,
                  do_filling: bool = True,
-                 do_discontinuity_adjustment: bool = False):
+                 do_discontinuity_adjustment: bool = False,
+                 cost_type: str = 'float32',
+                 cost_layout: str = 'pixel',
+                 num_threads: int = 1,
+                 cross_aggr_method: str = 'direct',
+                 num_iters: int = 4,
+                 so_num_paths: int = 4,
+                 so_fixed_point: bool = False,
+                 so_fused_wta: bool = False,
+                 confidence_measure: str = 'peak_ratio',
+                 huge_pages: bool = False):
+        
+        if cost_type not in _COST_TYPES:
+            raise ValueError(f"cost_type must be one of {list(_COST_TYPES)}, got: {cost_type}")
+        if cost_layout not in _COST_LAYOUTS:
+            raise ValueError(f"cost_layout must be one of {list(_COST_LAYOUTS)}, got: {cost_layout}")
+        if cross_aggr_method not in _CROSS_AGGR_METHODS:
+            raise ValueError(f"cross_aggr_method must be one of {list(_CROSS_AGGR_METHODS)}, got: {cross_aggr_method}")
+        if so_num_paths not in (4, 8, 16):
+            raise ValueError(f"so_num_paths must be 4, 8 or 16, got: {so_num_paths}")
+        if confidence_measure not in _CONFIDENCE_MEASURES:
+            raise ValueError(f"confidence_measure must be one of {list(_CONFIDENCE_MEASURES)}, got: {confidence_measure}")
         
         self.min_disparity = min_disparity
         self.max_disparity = max_disparity
@@ -87,22 +127,36 @@ class ADCensusStereo:
         self.do_lr_check = do_lr_check
         self.do_filling = do_filling
         self.do_discontinuity_adjustment = do_discontinuity_adjustment
+        self.cost_type = cost_type
+        self.cost_layout = cost_layout
+        self.num_threads = num_threads
+        self.cross_aggr_method = cross_aggr_method
+        self.num_iters = num_iters
+        self.so_num_paths = so_num_paths
+        self.so_fixed_point = so_fixed_point
+        self.so_fused_wta = so_fused_wta
+        self.confidence_measure = confidence_measure
+        self.huge_pages = huge_pages
         
         self._stereo = _ADCensus()
         self._initialized = False
         
     def compute(self, 
                 left_image: Union[str, np.ndarray], 
-                right_image: Union[str, np.ndarray]) -> np.ndarray:
+                right_image: Union[str, np.ndarray],
+                return_confidence: bool = False):
         """
         Compute disparity map from stereo image pair.
         
         Parameters:
             left_image: Left image as file path (str) or numpy array
             right_image: Right image as file path (str) or numpy array
+            return_confidence: Also return the confidence of the winner-take-all disparities
+                (before refinement), measured by confidence_measure, 0 where there is no valid disparity
             
         Returns:
-            Disparity map as numpy array (float32, shape: [height, width])
+            Disparity map as numpy array (float32, shape: [height, width]),
+            or the tuple (disparity, confidence) with return_confidence
         """
         # Load images if they are file paths
         if isinstance(left_image, str):
@@ -144,7 +198,17 @@ class ADCensusStereo:
                 self.so_tso, self.irv_ts, self.irv_th,
                 self.lrcheck_thres,
                 self.do_lr_check, self.do_filling,
-                self.do_discontinuity_adjustment
+                self.do_discontinuity_adjustment,
+                _COST_TYPES[self.cost_type],
+                _COST_LAYOUTS[self.cost_layout],
+                self.num_threads,
+                _CROSS_AGGR_METHODS[self.cross_aggr_method],
+                self.num_iters,
+                self.so_num_paths,
+                self.so_fixed_point,
+                self.so_fused_wta,
+                _CONFIDENCE_MEASURES[self.confidence_measure],
+                self.huge_pages
             )
             if not self._initialized:
                 raise RuntimeError("Failed to initialize AD-Census stereo matcher")
@@ -154,6 +218,8 @@ class ADCensusStereo:
         img_right = np.ascontiguousarray(img_right, dtype=np.uint8)
         
         # Compute disparity
+        if return_confidence:
+            return self._stereo.compute_disparity_confidence(img_left, img_right)
         disparity = self._stereo.compute_disparity(img_left, img_right)
         
         return disparity
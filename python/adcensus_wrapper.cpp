@@ -36,7 +36,17 @@ public:
                    float lrcheck_thres = 1.0f,
                    bool do_lr_check = true,
                    bool do_filling = true,
-                   bool do_discontinuity_adjustment = false) {
+                   bool do_discontinuity_adjustment = false,
+                   int cost_type = 0,
+                   int cost_layout = 0,
+                   int num_threads = 1,
+                   int cross_aggr_method = 0,
+                   int num_iters = 4,
+                   int so_num_paths = 4,
+                   bool so_fixed_point = false,
+                   bool so_fused_wta = false,
+                   int confidence_measure = 0,
+                   bool huge_pages = false) {
         
         width_ = width;
         height_ = height;
@@ -59,6 +69,31 @@ public:
         option.do_lr_check = do_lr_check;
         option.do_filling = do_filling;
         option.do_discontinuity_adjustment = do_discontinuity_adjustment;
+        if (cost_type < CostFloat32 || cost_type > CostUInt8) {
+            throw std::invalid_argument("cost_type must be 0 (float32), 1 (uint16) or 2 (uint8)");
+        }
+        option.cost_type = static_cast<CostType>(cost_type);
+        if (cost_layout < CostPixelMajor || cost_layout > CostDisparityMajor) {
+            throw std::invalid_argument("cost_layout must be 0 (pixel-major) or 1 (disparity-major)");
+        }
+        option.cost_layout = static_cast<CostLayout>(cost_layout);
+        option.num_threads = num_threads;
+        if (cross_aggr_method < CrossAggrDirect || cross_aggr_method > CrossAggrIntegral) {
+            throw std::invalid_argument("cross_aggr_method must be 0 (direct) or 1 (integral)");
+        }
+        option.cross_aggr_method = static_cast<CrossAggrMethod>(cross_aggr_method);
+        option.num_iters = num_iters;
+        if (so_num_paths != 4 && so_num_paths != 8 && so_num_paths != 16) {
+            throw std::invalid_argument("so_num_paths must be 4, 8 or 16");
+        }
+        option.so_num_paths = so_num_paths;
+        option.so_fixed_point = so_fixed_point;
+        option.so_fused_wta = so_fused_wta;
+        if (confidence_measure < ConfidencePeakRatio || confidence_measure > ConfidenceCurvature) {
+            throw std::invalid_argument("confidence_measure must be 0 (peak ratio) or 1 (curvature)");
+        }
+        option.confidence_measure = static_cast<ConfidenceMeasure>(confidence_measure);
+        option.huge_pages = huge_pages;
         
         initialized_ = stereo_.Initialize(width, height, option);
         return initialized_;
@@ -66,6 +101,21 @@ public:
 
     py::array_t<float> compute_disparity(py::array_t<uint8_t> img_left, 
                                           py::array_t<uint8_t> img_right) {
+        return match(img_left, img_right, nullptr);
+    }
+
+    py::tuple compute_disparity_confidence(py::array_t<uint8_t> img_left,
+                                           py::array_t<uint8_t> img_right) {
+        auto confidence = py::array_t<float>(width_ * height_);
+        auto disparity = match(img_left, img_right, static_cast<float*>(confidence.request().ptr));
+        confidence.resize({height_, width_});
+        return py::make_tuple(disparity, confidence);
+    }
+
+private:
+    py::array_t<float> match(py::array_t<uint8_t> img_left,
+                             py::array_t<uint8_t> img_right,
+                             float* ptr_confidence) {
         if (!initialized_) {
             throw std::runtime_error("ADCensus not initialized. Call initialize() first.");
         }
@@ -103,7 +153,7 @@ public:
         float* ptr_disp = static_cast<float*>(buf_disp.ptr);
 
         // Compute disparity
-        if (!stereo_.Match(ptr_left, ptr_right, ptr_disp)) {
+        if (!stereo_.Match(ptr_left, ptr_right, ptr_disp, ptr_confidence)) {
             throw std::runtime_error("Stereo matching failed");
         }
 
@@ -138,10 +188,24 @@ PYBIND11_MODULE(adcensus_py, m) {
              py::arg("do_lr_check") = true,
              py::arg("do_filling") = true,
              py::arg("do_discontinuity_adjustment") = false,
+             py::arg("cost_type") = 0,
+             py::arg("cost_layout") = 0,
+             py::arg("num_threads") = 1,
+             py::arg("cross_aggr_method") = 0,
+             py::arg("num_iters") = 4,
+             py::arg("so_num_paths") = 4,
+             py::arg("so_fixed_point") = false,
+             py::arg("so_fused_wta") = false,
+             py::arg("confidence_measure") = 0,
+             py::arg("huge_pages") = false,
              "Initialize the AD-Census stereo matcher with given parameters")
         .def("compute_disparity", &ADCensusPython::compute_disparity,
              py::arg("img_left"),
              py::arg("img_right"),
-             "Compute disparity map from left and right stereo images");
+             "Compute disparity map from left and right stereo images")
+        .def("compute_disparity_confidence", &ADCensusPython::compute_disparity_confidence,
+             py::arg("img_left"),
+             py::arg("img_right"),
+             "Compute disparity map and the confidence of its winner-take-all disparities");
 }
 